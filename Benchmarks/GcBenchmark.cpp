@@ -0,0 +1,313 @@
+#include <algorithm>
+#include <bit>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <iterator>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "MemoryManager.hpp"
+
+namespace
+{
+    struct Node
+    {
+        Node *left = nullptr;
+        Node *right = nullptr;
+        char payload[48] = {};
+    };
+
+    struct ListNode
+    {
+        ListNode *next = nullptr;
+        size_t value = 0;
+    };
+
+    /**
+     * Objects and bytes allocated by workload, collector statistics are read from memory manager
+     */
+    struct Allocations
+    {
+        size_t objects = 0;
+        size_t bytes = 0;
+
+        template <class T> T *make()
+        {
+            objects++;
+            bytes += sizeof(T);
+            return sd::make<T>();
+        }
+        template <class T> T *makeArray(size_t length)
+        {
+            objects++;
+            bytes += length * sizeof(T);
+            return sd::makeArray<T>(length);
+        }
+    };
+
+    struct Result
+    {
+        std::string workload;
+        size_t heapSize = 0;
+        size_t threads = 1;
+        Allocations allocations;
+        std::chrono::nanoseconds wallTime{0};
+        sd::MemoryManager::Stats stats;
+    };
+
+    Node *makeTree(Allocations &allocations, int depth)
+    {
+        auto node = allocations.make<Node>();
+        if (depth > 0)
+        {
+            node->left = makeTree(allocations, depth - 1);
+            node->right = makeTree(allocations, depth - 1);
+        }
+        return node;
+    }
+
+    /**
+     * Long lived tree and many short lived trees of growing depth, like binary-trees from benchmarks game
+     */
+    void binaryTrees(Allocations &allocations, size_t scale)
+    {
+        int maxDepth = 12 + static_cast<int>(std::bit_width(scale)) - 1;
+        sd::GcRoot<Node> longLived = makeTree(allocations, maxDepth);
+        for (int depth = 4; depth <= maxDepth; depth += 2)
+        {
+            auto iterations = size_t{1} << (maxDepth - depth + 4);
+            for (size_t i = 0; i < iterations; i++)
+            {
+                makeTree(allocations, depth);
+            }
+        }
+    }
+
+    /**
+     * Queue of list nodes, new nodes are appended to tail of old ones and head is dropped, so objects die in order
+     */
+    void listChurn(Allocations &allocations, size_t scale)
+    {
+        size_t length = 10000 * scale;
+        sd::GcRoot<ListNode> head = allocations.make<ListNode>();
+        auto tail = head.get();
+        for (size_t i = 1; i < length; i++)
+        {
+            tail->next = allocations.make<ListNode>();
+            tail = tail->next;
+        }
+        for (size_t i = 0; i < 100 * length; i++)
+        {
+            tail->next = allocations.make<ListNode>();
+            tail = tail->next;
+            tail->value = i;
+            head = head->next;
+        }
+    }
+
+    /**
+     * Ring of big pointer free arrays, most of heap is made of large objects
+     */
+    void largeArrays(Allocations &allocations, size_t scale)
+    {
+        constexpr size_t ringSize = 16;
+        std::mt19937 random{42};
+        sd::GcRoot<size_t *> ring = allocations.makeArray<size_t *>(ringSize);
+        for (size_t i = 0; i < 500 * scale; i++)
+        {
+            auto length = (4 * 1024) << (random() % 6); // 32KB - 1MB
+            auto array = allocations.makeArray<size_t>(length);
+            array[0] = array[length - 1] = i;
+            ring[i % ringSize] = array;
+        }
+    }
+
+    std::vector<uintptr_t> falsePointers;
+
+    /**
+     * Allocates garbage at bottom of deep recursion, frames are filled with integers looking like pointers into heap
+     */
+    __attribute__((noinline)) size_t deepStack(Allocations &allocations, size_t depth, size_t scale)
+    {
+        volatile uintptr_t frame[16];
+        for (size_t i = 0; i < std::size(frame); i++)
+        {
+            frame[i] = falsePointers.empty() ? 0 : falsePointers[(depth * 16 + i) % falsePointers.size()];
+        }
+        if (depth)
+        {
+            return deepStack(allocations, depth - 1, scale) + frame[depth % std::size(frame)];
+        }
+        for (size_t i = 0; i < 200000 * scale; i++)
+        {
+            auto node = allocations.make<ListNode>();
+            if (i % 97 == 0 && falsePointers.size() < 4096)
+            {
+                // start of object which soon becomes garbage, its cell is reused by later allocations
+                falsePointers.push_back(reinterpret_cast<uintptr_t>(node));
+            }
+        }
+        return frame[0];
+    }
+
+    void deepStacks(Allocations &allocations, size_t scale)
+    {
+        falsePointers.clear();
+        for (int i = 0; i < 4; i++)
+        {
+            deepStack(allocations, 2000, scale);
+        }
+        falsePointers.clear();
+    }
+
+    Result run(const std::string &name, const std::function<void(Allocations &, size_t)> &workload, size_t heapSize,
+               size_t scale)
+    {
+        using Policy = sd::MemoryManager::GrowthFactorPacingPolicy;
+        auto &manager = sd::MemoryManager::instance();
+        // limit shrinks back to heap size after collection ending previous run
+        manager.setPacingPolicy(std::make_unique<Policy>(2.0, heapSize, SIZE_MAX, 1));
+        manager.garbageCollect();
+        manager.resetStats();
+
+        Result result;
+        result.workload = name;
+        result.heapSize = heapSize;
+        auto start = std::chrono::steady_clock::now();
+        workload(result.allocations, scale);
+        result.wallTime = std::chrono::steady_clock::now() - start;
+        result.stats = manager.stats();
+        return result;
+    }
+
+    /**
+     * Threads registered in shared heap allocate short lived lists concurrently, measures scaling of allocation
+     */
+    Result runShared(size_t threads, size_t heapSize, size_t scale)
+    {
+        using Policy = sd::MemoryManager::GrowthFactorPacingPolicy;
+        auto &manager = sd::MemoryManager::shared();
+        manager.setPacingPolicy(std::make_unique<Policy>(2.0, heapSize, SIZE_MAX, 1));
+        manager.garbageCollect();
+        manager.resetStats();
+
+        Result result;
+        result.workload = "shared-producers";
+        result.heapSize = heapSize;
+        result.threads = threads;
+        std::vector<Allocations> allocations(threads);
+        std::vector<std::thread> producers;
+        auto start = std::chrono::steady_clock::now();
+        for (auto &threadAllocations : allocations)
+        {
+            producers.emplace_back([&threadAllocations, scale] {
+                sd::GcThreadScope scope;
+                ListNode *head = nullptr;
+                for (size_t i = 0; i < 500000 * scale; i++)
+                {
+                    auto node = threadAllocations.make<ListNode>();
+                    node->next = i % 100 ? head : nullptr;
+                    head = node;
+                }
+            });
+        }
+        for (auto &producer : producers)
+        {
+            producer.join();
+        }
+        result.wallTime = std::chrono::steady_clock::now() - start;
+        for (auto &threadAllocations : allocations)
+        {
+            result.allocations.objects += threadAllocations.objects;
+            result.allocations.bytes += threadAllocations.bytes;
+        }
+        result.stats = manager.stats();
+        manager.setPacingPolicy(nullptr);
+        return result;
+    }
+
+    double toMs(std::chrono::nanoseconds time) { return std::chrono::duration<double, std::milli>(time).count(); }
+
+    double getThroughput(const Result &result)
+    {
+        auto seconds = std::chrono::duration<double>(result.wallTime).count();
+        return seconds > 0 ? result.allocations.bytes / seconds / (1024 * 1024) : 0;
+    }
+
+    void printResult(const Result &result)
+    {
+        std::cout << std::fixed << std::setprecision(2) << result.workload << ", heap: " << result.heapSize / 1024
+                  << " KB, threads: " << result.threads << ", throughput: " << getThroughput(result) << " MB/s"
+                  << ", collections: " << result.stats.collections << ", gc: " << toMs(result.stats.totalPause)
+                  << " ms, p50: " << toMs(result.stats.pauses.percentile(0.5))
+                  << " ms, p99: " << toMs(result.stats.pauses.percentile(0.99))
+                  << " ms, max: " << toMs(result.stats.pauses.max()) << " ms" << std::endl;
+    }
+
+    void writeJson(std::ostream &out, const std::vector<Result> &results)
+    {
+        out << std::fixed << std::setprecision(3) << "{\"results\":[";
+        for (size_t i = 0; i < results.size(); i++)
+        {
+            auto &result = results[i];
+            auto &pauses = result.stats.pauses;
+            out << (i ? "," : "") << "\n  {\"workload\":\"" << result.workload << "\",\"heapSize\":" << result.heapSize
+                << ",\"threads\":" << result.threads << ",\"allocatedObjects\":" << result.allocations.objects
+                << ",\"allocatedBytes\":" << result.allocations.bytes << ",\"wallMs\":" << toMs(result.wallTime)
+                << ",\"throughputMBps\":" << getThroughput(result) << ",\"collections\":" << result.stats.collections
+                << ",\"gcMs\":" << toMs(result.stats.totalPause) << ",\"markMs\":" << toMs(result.stats.totalMarkTime)
+                << ",\"sweepMs\":" << toMs(result.stats.totalSweepTime)
+                << ",\"pauseP50Ms\":" << toMs(pauses.percentile(0.5))
+                << ",\"pauseP99Ms\":" << toMs(pauses.percentile(0.99)) << ",\"pauseMaxMs\":" << toMs(pauses.max())
+                << "}";
+        }
+        out << "\n]}" << std::endl;
+    }
+} // namespace
+
+/**
+ * Runs allocation heavy workloads for several initial memory limits, then shared heap producers for growing number of
+ * threads, reports allocation throughput, collection time and pause percentiles,
+ * usage: GcBenchmark [json output file] [scale]
+ */
+int main(int argc, char **argv)
+{
+    size_t scale = argc > 2 ? std::max(std::atoi(argv[2]), 1) : 1;
+    std::vector<std::pair<std::string, std::function<void(Allocations &, size_t)>>> workloads = {
+        {"binary-trees", binaryTrees},
+        {"list-churn", listChurn},
+        {"large-arrays", largeArrays},
+        {"deep-stacks", deepStacks},
+    };
+    std::vector<size_t> heapSizes = {1024 * 1024, 4 * 1024 * 1024, 16 * 1024 * 1024};
+
+    std::vector<Result> results;
+    for (auto &[name, workload] : workloads)
+    {
+        for (auto heapSize : heapSizes)
+        {
+            printResult(results.emplace_back(run(name, workload, heapSize, scale)));
+        }
+    }
+    sd::MemoryManager::instance().setPacingPolicy(nullptr);
+    // at least 1, 2 and 4 producers, so scaling of allocation fast path is visible also on small machines
+    size_t maxThreads = std::max(std::thread::hardware_concurrency(), 4u);
+    for (size_t threads = 1; threads <= maxThreads; threads *= 2)
+    {
+        printResult(results.emplace_back(runShared(threads, heapSizes.back(), scale)));
+    }
+
+    if (argc > 1)
+    {
+        std::ofstream out{argv[1]};
+        writeJson(out, results);
+    }
+    return 0;
+}
@@ -0,0 +1,54 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <thread>
+
+#include "MemoryManager.hpp"
+
+namespace
+{
+    struct Node
+    {
+        Node *left = nullptr;
+        Node *right = nullptr;
+        char payload[48] = {};
+    };
+
+    Node *makeTree(int depth)
+    {
+        auto node = sd::make<Node>();
+        if (depth > 0)
+        {
+            node->left = makeTree(depth - 1);
+            node->right = makeTree(depth - 1);
+        }
+        return node;
+    }
+} // namespace
+
+/**
+ * Measures stop the world collection time of heap with live binary tree for different numbers of mark threads,
+ * usage: Benchmark [tree depth] [max mark threads]
+ */
+int main(int argc, char **argv)
+{
+    int depth = argc > 1 ? std::atoi(argv[1]) : 20; // 2^21 - 1 objects
+    auto &manager = sd::MemoryManager::instance();
+
+    auto root = makeTree(depth);
+    manager.garbageCollect();
+
+    std::cout << "objects: " << (2 << depth) - 1 << ", heap: " << manager.getAllocatedMemory() / 1024 << " KB"
+              << std::endl;
+    size_t maxThreads = argc > 2 ? std::atoi(argv[2]) : std::max(std::thread::hardware_concurrency(), 1u);
+    for (size_t threads = 1; threads <= maxThreads; threads *= 2)
+    {
+        manager.setMarkThreads(threads);
+        auto start = std::chrono::steady_clock::now();
+        manager.garbageCollect();
+        auto time = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start);
+        std::cout << "mark threads: " << threads << ", collection time: " << time.count() << " ms" << std::endl;
+    }
+    return root ? 0 : 1;
+}
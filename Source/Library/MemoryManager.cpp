@@ -1,4 +1,14 @@
+#include <charconv>
+#include <condition_variable>
+#include <cstdio>
+#include <deque>
+#include <fstream>
+#include <map>
+#include <mutex>
+#include <ostream>
 #include <setjmp.h>
+#include <thread>
+#include <typeindex>
 #include <vector>
 
 #include "DetectOs.hpp"
@@ -11,7 +21,15 @@
 #endif
 
 #if defined(LINUX) || defined(APPLE)
+#include <execinfo.h>
+#include <fcntl.h>
 #include <pthread.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+#if defined(__GNUG__)
+#include <cxxabi.h>
 #endif
 
 namespace sd
@@ -34,6 +52,19 @@ namespace sd
             return (uint8_t *)ptr;
         }
 
+        /**
+         * Zeroes stack below calling frame, frames of following calls will not contain stale pointers left there by
+         * earlier calls, which conservative stack scan would treat as roots
+         */
+        __attribute__((noinline)) void clearStack()
+        {
+            volatile uint8_t buffer[16 * 1024];
+            for (auto &byte : buffer)
+            {
+                byte = 0;
+            }
+        }
+
 #ifdef WINDOWS
         auto getStackBounds()
         {
@@ -48,11 +79,16 @@ namespace sd
         auto getStackBounds()
         {
             auto rsp = getStackRsp();
-            pthread_attr_t attrs;
-            pthread_getattr_np(pthread_self(), &attrs);
-            void *stack_ptr;
-            size_t stack_size;
-            pthread_attr_getstack(&attrs, &stack_ptr, &stack_size);
+            // bounds of thread stack do not change, they are queried once per thread
+            static thread_local void *stack_ptr = nullptr;
+            static thread_local size_t stack_size = 0;
+            if (!stack_ptr)
+            {
+                pthread_attr_t attrs;
+                pthread_getattr_np(pthread_self(), &attrs);
+                pthread_attr_getstack(&attrs, &stack_ptr, &stack_size);
+                pthread_attr_destroy(&attrs);
+            }
 
             return std::make_tuple((uint8_t *)stack_ptr + stack_size - 10, (uint8_t *)stack_ptr, rsp);
         }
@@ -69,120 +105,2391 @@ namespace sd
             return std::make_tuple((uint8_t *)stack_ptr - 10, (uint8_t *)stack_ptr - stack_size, rsp);
         }
 #endif
+
+#ifdef WINDOWS
+        uint8_t *mapMemory(size_t size, size_t alignment)
+        {
+            while (true)
+            {
+                // reserve more to find aligned address, then map exactly there
+                auto raw = static_cast<uint8_t *>(VirtualAlloc(nullptr, size + alignment, MEM_RESERVE, PAGE_NOACCESS));
+                if (!raw)
+                {
+                    throw std::bad_alloc();
+                }
+                auto aligned = (reinterpret_cast<uintptr_t>(raw) + alignment - 1) & ~(alignment - 1);
+                VirtualFree(raw, 0, MEM_RELEASE);
+                if (auto ptr = VirtualAlloc(reinterpret_cast<void *>(aligned), size, MEM_RESERVE | MEM_COMMIT,
+                                            PAGE_READWRITE))
+                {
+                    return static_cast<uint8_t *>(ptr);
+                }
+            }
+        }
+
+        void unmapMemory(uint8_t *ptr, size_t) { VirtualFree(ptr, 0, MEM_RELEASE); }
+        void commitMemory(uint8_t *ptr, size_t size) { VirtualAlloc(ptr, size, MEM_COMMIT, PAGE_READWRITE); }
+        void decommitMemory(uint8_t *ptr, size_t size) { VirtualFree(ptr, size, MEM_DECOMMIT); }
+#endif
+#if defined(LINUX) || defined(APPLE)
+        uint8_t *mapMemory(size_t size, size_t alignment)
+        {
+            // map more to find aligned address, then unmap unaligned head and tail
+            auto raw = mmap(nullptr, size + alignment, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+            if (raw == MAP_FAILED)
+            {
+                throw std::bad_alloc();
+            }
+            auto begin = static_cast<uint8_t *>(raw);
+            auto aligned = reinterpret_cast<uint8_t *>((reinterpret_cast<uintptr_t>(begin) + alignment - 1) &
+                                                       ~(alignment - 1));
+            if (aligned > begin)
+            {
+                munmap(begin, aligned - begin);
+            }
+            if (begin + alignment > aligned)
+            {
+                munmap(aligned + size, begin + alignment - aligned);
+            }
+            return aligned;
+        }
+
+        void unmapMemory(uint8_t *ptr, size_t size) { munmap(ptr, size); }
+        // pages of private anonymous mapping are faulted in again on first touch
+        void commitMemory(uint8_t *, size_t) {}
+        void decommitMemory(uint8_t *ptr, size_t size) { madvise(ptr, size, MADV_DONTNEED); }
+#endif
+
+        std::string getTypeName(const std::type_info &type)
+        {
+#if defined(__GNUG__)
+            int status = 0;
+            std::unique_ptr<char, decltype(&std::free)> name{
+                abi::__cxa_demangle(type.name(), nullptr, nullptr, &status), &std::free};
+            if (status == 0 && name)
+            {
+                return name.get();
+            }
+#endif
+            return type.name();
+        }
+
+        void writeJsonString(std::ostream &out, const std::string &value)
+        {
+            out << '"';
+            for (auto c : value)
+            {
+                if (c == '"' || c == '\\')
+                {
+                    out << '\\';
+                }
+                out << c;
+            }
+            out << '"';
+        }
+
+        std::vector<void *> captureStack()
+        {
+            constexpr int maxFrames = 32;
+            void *frames[maxFrames];
+#ifdef WINDOWS
+            int count = CaptureStackBackTrace(0, maxFrames, frames, nullptr);
+#else
+            int count = backtrace(frames, maxFrames);
+#endif
+            return std::vector<void *>(frames, frames + std::max(count, 0));
+        }
+
+        std::vector<std::string> getFrameNames(const std::vector<void *> &frames)
+        {
+            std::vector<std::string> names;
+#ifdef WINDOWS
+            for (auto frame : frames)
+            {
+                char name[2 * sizeof(void *) + 3];
+                snprintf(name, sizeof(name), "%p", frame);
+                names.emplace_back(name);
+            }
+#else
+            std::unique_ptr<char *, decltype(&std::free)> symbols{
+                backtrace_symbols(frames.data(), static_cast<int>(frames.size())), &std::free};
+            for (size_t i = 0; i < frames.size(); i++)
+            {
+                names.emplace_back(symbols ? symbols.get()[i] : "?");
+            }
+#endif
+            return names;
+        }
+
+#ifdef LINUX
+        /**
+         * Reads number at given position from start of open file, returns 0 when file holds no such number or "max"
+         */
+        size_t readFileValue(int file, size_t index = 0)
+        {
+            char text[128];
+            auto size = pread(file, text, sizeof(text), 0);
+            auto begin = text, end = text + std::max<ssize_t>(size, 0);
+            for (; index && begin != end; index--)
+            {
+                begin = std::find(begin, end, ' ');
+                begin += begin != end;
+            }
+            size_t value = 0;
+            std::from_chars(begin, end, value);
+            return value;
+        }
+
+        std::string findCgroupPath()
+        {
+            // cgroup v2 entry has empty hierarchy id and controllers list
+            std::ifstream cgroups{"/proc/self/cgroup"};
+            std::string line;
+            while (std::getline(cgroups, line))
+            {
+                if (line.starts_with("0::"))
+                {
+                    return "/sys/fs/cgroup" + line.substr(3);
+                }
+            }
+            return {};
+        }
+#endif
+
+        template <class T> void writeBinaryValue(std::ostream &out, T value)
+        {
+            out.write(reinterpret_cast<const char *>(&value), sizeof(value));
+        }
+
+        /**
+         * Mark stack shared between marking threads, owner pushes and pops from back, other threads steal from front
+         */
+        class MarkQueue
+        {
+          private:
+            std::mutex _mutex;
+            std::deque<void *> _items;
+            std::atomic<size_t> _size = 0;
+
+          public:
+            void push(std::vector<void *> &items, size_t count)
+            {
+                std::lock_guard lock{_mutex};
+                _items.insert(_items.end(), items.end() - count, items.end());
+                items.resize(items.size() - count);
+                _size = _items.size();
+            }
+
+            bool pop(std::vector<void *> &items, size_t count, bool steal)
+            {
+                if (!_size)
+                {
+                    return false;
+                }
+                std::lock_guard lock{_mutex};
+                count = std::min(count, _items.size());
+                if (steal)
+                {
+                    items.insert(items.end(), _items.begin(), _items.begin() + count);
+                    _items.erase(_items.begin(), _items.begin() + count);
+                }
+                else
+                {
+                    items.insert(items.end(), _items.end() - count, _items.end());
+                    _items.erase(_items.end() - count, _items.end());
+                }
+                _size = _items.size();
+                return count;
+            }
+
+            bool empty() const { return !_size; }
+        };
     } // namespace
 
+    MemoryManager::Chunk::Chunk(size_t minSize)
+    {
+        auto size = (minSize + Size - 1) / Size * Size;
+        _begin = mapMemory(size, Size);
+        _end = _begin + size;
+        _top = _begin;
+    }
+
+    MemoryManager::Chunk::~Chunk() { unmapMemory(_begin, size()); }
+
+    void MemoryManager::Chunk::commit()
+    {
+        if (!_committed)
+        {
+            commitMemory(_begin, size());
+            _committed = true;
+        }
+    }
+
+    void MemoryManager::Chunk::decommit()
+    {
+        if (_committed)
+        {
+            decommitMemory(_begin, size());
+            _committed = false;
+        }
+    }
+
+    /**
+     * Thread destroying unreachable objects handed over by sweep, so destructors do not run on allocating thread
+     */
+    class MemoryManager::BackgroundSweeper
+    {
+      private:
+        std::mutex _mutex;
+        std::condition_variable _workAvailable;
+        std::condition_variable _workDone;
+        std::vector<std::unique_ptr<IObjectHolder>> _queue;
+        bool _busy = false;
+        bool _stop = false;
+        std::thread _thread;
+
+      public:
+        BackgroundSweeper() : _thread([this] { run(); }) {}
+        ~BackgroundSweeper()
+        {
+            {
+                std::lock_guard lock{_mutex};
+                _stop = true;
+            }
+            _workAvailable.notify_one();
+            _thread.join();
+        }
+
+        void enqueue(std::vector<std::unique_ptr<IObjectHolder>> &objectHolders)
+        {
+            {
+                std::lock_guard lock{_mutex};
+                std::move(objectHolders.begin(), objectHolders.end(), std::back_inserter(_queue));
+            }
+            objectHolders.clear();
+            _workAvailable.notify_one();
+        }
+
+        void wait()
+        {
+            std::unique_lock lock{_mutex};
+            _workDone.wait(lock, [this] { return _queue.empty() && !_busy; });
+        }
+
+      private:
+        void run()
+        {
+            std::unique_lock lock{_mutex};
+            while (true)
+            {
+                _workAvailable.wait(lock, [this] { return _stop || !_queue.empty(); });
+                if (_queue.empty())
+                {
+                    return;
+                }
+                auto batch = std::move(_queue);
+                _queue.clear();
+                _busy = true;
+                lock.unlock();
+                batch.clear(); // destroys objects
+                lock.lock();
+                _busy = false;
+                _workDone.notify_all();
+            }
+        }
+    };
+
+    /**
+     * Threads helping with parallel marking, started once and woken for every collection
+     */
+    class MemoryManager::MarkHelpers
+    {
+      private:
+        std::mutex _mutex;
+        std::condition_variable _workAvailable;
+        std::condition_variable _workDone;
+        std::function<void(size_t)> _task;
+        size_t _generation = 0;
+        size_t _running = 0;
+        bool _stop = false;
+        std::vector<std::thread> _threads;
+
+      public:
+        explicit MarkHelpers(size_t count)
+        {
+            for (size_t i = 1; i <= count; i++)
+            {
+                _threads.emplace_back([this, i] { run(i); });
+            }
+        }
+        ~MarkHelpers()
+        {
+            {
+                std::lock_guard lock{_mutex};
+                _stop = true;
+            }
+            _workAvailable.notify_all();
+            for (auto &thread : _threads)
+            {
+                thread.join();
+            }
+        }
+
+        size_t size() const { return _threads.size(); }
+
+        /**
+         * Run task on calling thread with id 0 and on every helper with ids starting from 1, return when all finished
+         */
+        void runAll(std::function<void(size_t)> task)
+        {
+            {
+                std::lock_guard lock{_mutex};
+                _task = std::move(task);
+                _running = _threads.size();
+                _generation++;
+            }
+            _workAvailable.notify_all();
+            _task(0);
+            std::unique_lock lock{_mutex};
+            _workDone.wait(lock, [this] { return _running == 0; });
+            _task = nullptr;
+        }
+
+      private:
+        void run(size_t id)
+        {
+            size_t generation = 0;
+            std::unique_lock lock{_mutex};
+            while (true)
+            {
+                _workAvailable.wait(lock, [&] { return _stop || _generation != generation; });
+                if (_stop)
+                {
+                    return;
+                }
+                generation = _generation;
+                lock.unlock();
+                _task(id);
+                lock.lock();
+                if (--_running == 0)
+                {
+                    _workDone.notify_one();
+                }
+            }
+        }
+    };
+
     MemoryManager &MemoryManager::instance()
     {
+        if (currentThread())
+        {
+            return shared();
+        }
         static thread_local MemoryManager ob;
         return ob;
     }
 
-    MemoryManager::~MemoryManager() { clear(); }
+    MemoryManager &MemoryManager::shared()
+    {
+        static MemoryManager ob{true};
+        return ob;
+    }
 
-    size_t MemoryManager::garbageCollect()
+    MemoryManager::ThreadRecord *MemoryManager::currentThread() { return currentThreadRecord().get(); }
+
+    std::unique_ptr<MemoryManager::ThreadRecord> &MemoryManager::currentThreadRecord()
     {
-        auto snapshot = getAllocatedMemory();
-        mark();
-        sweep();
-        auto freedBytes = snapshot - getAllocatedMemory();
-        return freedBytes;
+        struct CurrentThread
+        {
+            std::unique_ptr<ThreadRecord> record;
+            // thread that exits without unregistering would block shared heap collections forever
+            ~CurrentThread()
+            {
+                if (record)
+                {
+                    unregisterThread();
+                }
+            }
+        };
+        static thread_local CurrentThread current;
+        return current.record;
     }
 
-    size_t MemoryManager::getAllocatedMemory() const { return _allocatedMemory; }
+    void MemoryManager::registerThread()
+    {
+        auto &record = currentThreadRecord();
+        if (record)
+        {
+            return;
+        }
+        auto [top, bot, rsp] = getStackBounds();
+        auto &manager = shared();
+        std::unique_lock lock{manager._worldMutex};
+        // not yet registered thread can not be parked, wait until ongoing collection ends
+        manager._worldChanged.wait(lock, [&] { return !manager._stopRequested; });
+        record = std::make_unique<ThreadRecord>();
+        record->stackTop = top;
+        manager._threads.push_back(record.get());
+    }
 
-    size_t MemoryManager::getMemoryLimit() const { return _memoryLimit; }
+    void MemoryManager::unregisterThread()
+    {
+        auto &record = currentThreadRecord();
+        if (!record)
+        {
+            return;
+        }
+        auto &manager = shared();
+        // objects of thread which are not registered yet would be lost with its record, collection can not start
+        // while thread is not parked, so it is safe to flush them after safepoint
+        safepoint();
+        {
+            std::lock_guard heapLock{manager._heapMutex};
+            manager.flushTlab(*record);
+            manager.updateTlabRoom();
+            record->tlab = nullptr;
+        }
+        std::unique_lock lock{manager._worldMutex};
+        while (manager._stopRequested)
+        {
+            manager.park(lock, *record);
+        }
+        std::erase(manager._threads, record.get());
+        record.reset();
+        manager._worldChanged.notify_all();
+    }
 
-    void MemoryManager::bumpMemoryLimit() { _memoryLimit *= 2; }
+    void MemoryManager::safepoint()
+    {
+        auto record = currentThread();
+        if (!record)
+        {
+            return;
+        }
+        auto &manager = shared();
+        if (!manager._stopRequested)
+        {
+            return;
+        }
+        std::unique_lock lock{manager._worldMutex};
+        while (manager._stopRequested)
+        {
+            manager.park(lock, *record);
+        }
+    }
 
-    void MemoryManager::clear()
+    void MemoryManager::enterSafeRegion()
     {
-        _objectsRegister.forEach([this](IObjectHolder &objectHolder) { destroyObject(objectHolder); });
-        _objectsRegister.clear();
+        auto record = currentThread();
+        if (!record || record->safeRegionDepth++)
+        {
+            return;
+        }
+        // push local variables stored in registers onto the stack.
+        jmp_buf jb;
+        setjmp(jb);
+        auto &manager = shared();
+        std::lock_guard lock{manager._worldMutex};
+        record->stackPointer = getStackRsp();
+        manager._parkedThreads++;
+        manager._worldChanged.notify_all();
     }
 
-    void MemoryManager::destroyObject(IObjectHolder &objectHolder)
+    void MemoryManager::leaveSafeRegion()
     {
-        auto objectSize = objectHolder.getObjectSize();
-        objectHolder.destroyObject();
-        _allocatedMemory -= objectSize;
+        auto record = currentThread();
+        if (!record || --record->safeRegionDepth)
+        {
+            return;
+        }
+        auto &manager = shared();
+        std::unique_lock lock{manager._worldMutex};
+        manager._worldChanged.wait(lock, [&] { return !manager._stopRequested; });
+        manager._parkedThreads--;
+        record->stackPointer = nullptr;
     }
 
-    bool MemoryManager::isGBCollectionNeeded() { return getAllocatedMemory() > getMemoryLimit(); }
+    void MemoryManager::park(std::unique_lock<std::mutex> &lock, ThreadRecord &record)
+    {
+        // push local variables stored in registers onto the stack.
+        jmp_buf jb;
+        setjmp(jb);
+        record.stackPointer = getStackRsp();
+        _parkedThreads++;
+        _worldChanged.notify_all();
+        _worldChanged.wait(lock, [this] { return !_stopRequested; });
+        _parkedThreads--;
+        record.stackPointer = nullptr;
+    }
 
-    void MemoryManager::mark()
+    void MemoryManager::stopTheWorld()
     {
-        auto worklist = getRoots();
+        auto record = currentThread();
+        std::unique_lock lock{_worldMutex};
+        while (_stopRequested)
+        {
+            // other thread is collecting already
+            if (record)
+            {
+                park(lock, *record);
+            }
+            else
+            {
+                _worldChanged.wait(lock, [this] { return !_stopRequested; });
+            }
+        }
+        _stopRequested = true;
+        _worldChanged.wait(lock, [&] { return _parkedThreads + (record ? 1 : 0) >= _threads.size(); });
+    }
 
-        while (!worklist.empty())
+    void MemoryManager::resumeTheWorld()
+    {
         {
-            auto ptr = worklist.back();
-            worklist.pop_back();
-            auto &objectHolder = _objectsRegister.getObjectHolder(ptr);
+            std::lock_guard lock{_worldMutex};
+            _stopRequested = false;
+        }
+        _worldChanged.notify_all();
+    }
 
-            if (objectHolder.isMarked())
+    size_t MemoryManager::sharedGarbageCollect(bool onlyIfNeeded)
+    {
+        stopTheWorld();
+        size_t freedBytes = 0;
+        {
+            std::lock_guard lock{_heapMutex};
+            retireTlabs();
+            // other thread could collect while this one was waiting
+            if (!onlyIfNeeded || isGBCollectionNeeded())
             {
-                continue;
+                auto snapshot = getAllocatedMemory();
+                collect(false);
+                finishSweep();
+                freedBytes = snapshot - getAllocatedMemory();
             }
-            objectHolder.mark();
-            for (const auto &p : getInnerObjects(objectHolder))
+            if (onlyIfNeeded && !_collectionPending && isGBCollectionNeeded())
             {
-                worklist.push_back(p);
+                bumpMemoryLimit();
             }
+            updateTlabRoom();
         }
+        resumeTheWorld();
+        return freedBytes;
     }
 
-    void MemoryManager::sweep()
+    MemoryManager::Chunk &MemoryManager::takeTlabChunk()
     {
-        _objectsRegister.unregisterIf([this](IObjectHolder &objectHolder) {
-            if (objectHolder.isMarked())
+        while (true)
+        {
+            // chunks are pushed back only after collection retired all buffers, thread can not be stopped inside this
+            // loop, so chunk popped here can not be reused by another pop in the meantime
+            auto chunk = _tlabChunks.load();
+            while (chunk && !_tlabChunks.compare_exchange_weak(chunk, chunk->getNext()))
             {
-                objectHolder.unmark();
-                return false;
             }
-            else
+            if (chunk)
             {
-                destroyObject(objectHolder);
-                return true;
+                chunk->setNext(nullptr);
+                return *chunk;
             }
-        });
+            std::lock_guard lock{_heapMutex};
+            if (_tlabChunks.load())
+            {
+                continue; // other thread refilled stack
+            }
+            for (size_t i = 0; i < TlabRefillChunks; i++)
+            {
+                auto &fresh = allocateChunk(Chunk::Size);
+                fresh.promote(); // shared heap has no young generation
+                auto head = _tlabChunks.load();
+                do
+                {
+                    fresh.setNext(head);
+                } while (!_tlabChunks.compare_exchange_weak(head, &fresh));
+            }
+        }
     }
 
-    std::vector<void *> MemoryManager::getRoots()
+    void MemoryManager::flushTlab(ThreadRecord &record)
     {
-        // push local variables  stored in registers onto the stack.
-        jmp_buf jb;
-        setjmp(jb);
-
-        auto [top, bot, rsp] = getStackBounds();
-
-        std::vector<void *> result;
-        while (rsp < top)
+        for (auto &[objectHolder, frames] : record.pendingSamples)
         {
-            auto address = (void *)*reinterpret_cast<void **>(rsp);
-            if (_objectsRegister.isObjectRegistered(address))
+            sampleAllocation(*objectHolder, std::move(frames));
+        }
+        record.pendingSamples.clear();
+        for (auto &objectHolder : record.pendingObjects)
+        {
+            if (_pressureThreshold)
             {
-                result.emplace_back(address);
+                countPressureBytes(objectHolder->getObjectSize());
             }
-            rsp++;
+            _objectsRegister.registerObject(std::move(objectHolder));
         }
+        _allocatedMemory += record.pendingBytes;
+        _tlabBytes -= record.pendingBytes - record.unreportedBytes;
+        record.pendingObjects.clear();
+        record.pendingBytes = 0;
+        record.unreportedBytes = 0;
+    }
 
-        return result;
+    void MemoryManager::updateTlabRoom()
+    {
+        _tlabRoom = _memoryLimit > _allocatedMemory ? _memoryLimit - _allocatedMemory : 0;
     }
 
-    std::vector<void *> MemoryManager::getInnerObjects(const IObjectHolder &objectHolder)
+    void MemoryManager::retireTlabs()
     {
-        auto p = (uint8_t *)objectHolder.getObjectPtr();
-        auto end = (p + objectHolder.getObjectSize());
-        std::vector<void *> result;
-        while (p < end)
+        // world is stopped, partially filled buffers become ordinary chunks
+        for (auto record : _threads)
         {
-            auto address = (void *)*reinterpret_cast<void **>(p);
-            if (_objectsRegister.isObjectRegistered(address))
-            {
-                result.emplace_back(address);
+            flushTlab(*record);
+            record->tlab = nullptr;
+        }
+        // unused chunks are empty, so they are reclaimed by sweep
+        for (auto chunk = _tlabChunks.exchange(nullptr); chunk;)
+        {
+            auto next = chunk->getNext();
+            chunk->setNext(nullptr);
+            chunk = next;
+        }
+    }
+
+    MemoryManager::MemoryManager(bool shared) : _shared(shared) {}
+
+    MemoryManager::~MemoryManager()
+    {
+        clear();
+        closePressureFile();
+    }
+
+    size_t MemoryManager::garbageCollect()
+    {
+        if (_shared)
+        {
+            return sharedGarbageCollect(false);
+        }
+        auto snapshot = getAllocatedMemory();
+        collect(false);
+        finishSweep();
+        auto freedBytes = snapshot - getAllocatedMemory();
+        return freedBytes;
+    }
+
+    size_t MemoryManager::minorGarbageCollect()
+    {
+        auto snapshot = getAllocatedMemory();
+        collect(!_marking);
+        finishSweep();
+        auto freedBytes = snapshot - getAllocatedMemory();
+        return freedBytes;
+    }
+
+    MemoryManager::HeapSnapshot MemoryManager::takeHeapSnapshot()
+    {
+        garbageCollect();
+        std::unique_lock lock{_heapMutex, std::defer_lock};
+        if (_shared)
+        {
+            lock.lock();
+        }
+        HeapSnapshot snapshot;
+        std::unordered_map<std::type_index, size_t> typeIndexes;
+        auto indexOf = [&](const IObjectHolder &objectHolder) {
+            auto [it, inserted] = typeIndexes.try_emplace(objectHolder.getType(), snapshot.types.size());
+            if (inserted)
+            {
+                snapshot.types.push_back({getTypeName(objectHolder.getType())});
+            }
+            return it->second;
+        };
+        std::map<std::pair<size_t, size_t>, size_t> references;
+        _objectsRegister.forEach([&](IObjectHolder &objectHolder) {
+            auto &type = snapshot.types[indexOf(objectHolder)];
+            type.count++;
+            type.bytes += objectHolder.getObjectSize();
+            snapshot.objects++;
+            snapshot.bytes += objectHolder.getObjectSize();
+        });
+        _objectsRegister.forEach([&](IObjectHolder &objectHolder) {
+            auto from = indexOf(objectHolder);
+            forEachInnerObject(objectHolder, [&](void *p) {
+                references[{from, indexOf(_objectsRegister.getObjectHolder(p))}]++;
+            });
+        });
+        std::vector<void *> roots;
+        getRoots(roots);
+        for (auto p : roots)
+        {
+            snapshot.types[indexOf(_objectsRegister.getObjectHolder(p))].rootReferences++;
+        }
+
+        // order types by bytes and remap references to new positions
+        std::vector<size_t> order(snapshot.types.size());
+        for (size_t i = 0; i < order.size(); i++)
+        {
+            order[i] = i;
+        }
+        std::sort(order.begin(), order.end(),
+                  [&](size_t a, size_t b) { return snapshot.types[a].bytes > snapshot.types[b].bytes; });
+        std::vector<size_t> position(order.size());
+        std::vector<HeapSnapshot::TypeStats> types;
+        for (size_t i = 0; i < order.size(); i++)
+        {
+            position[order[i]] = i;
+            types.push_back(std::move(snapshot.types[order[i]]));
+        }
+        snapshot.types = std::move(types);
+        for (auto &[edge, count] : references)
+        {
+            snapshot.references.push_back({position[edge.first], position[edge.second], count});
+        }
+        return snapshot;
+    }
+
+    void MemoryManager::HeapSnapshot::writeJson(std::ostream &out) const
+    {
+        out << "{\"objects\":" << objects << ",\"bytes\":" << bytes << ",\"types\":[";
+        for (size_t i = 0; i < types.size(); i++)
+        {
+            out << (i ? "," : "") << "{\"name\":";
+            writeJsonString(out, types[i].name);
+            out << ",\"count\":" << types[i].count << ",\"bytes\":" << types[i].bytes
+                << ",\"rootReferences\":" << types[i].rootReferences << "}";
+        }
+        out << "],\"references\":[";
+        for (size_t i = 0; i < references.size(); i++)
+        {
+            out << (i ? "," : "") << "{\"from\":" << references[i].from << ",\"to\":" << references[i].to
+                << ",\"count\":" << references[i].count << "}";
+        }
+        out << "]}";
+    }
+
+    void MemoryManager::HeapSnapshot::writeBinary(std::ostream &out) const
+    {
+        out.write("SDHS", 4);
+        writeBinaryValue<uint32_t>(out, 1);
+        writeBinaryValue<uint64_t>(out, objects);
+        writeBinaryValue<uint64_t>(out, bytes);
+        writeBinaryValue<uint32_t>(out, types.size());
+        for (auto &type : types)
+        {
+            writeBinaryValue<uint32_t>(out, type.name.size());
+            out.write(type.name.data(), type.name.size());
+            writeBinaryValue<uint64_t>(out, type.count);
+            writeBinaryValue<uint64_t>(out, type.bytes);
+            writeBinaryValue<uint64_t>(out, type.rootReferences);
+        }
+        writeBinaryValue<uint32_t>(out, references.size());
+        for (auto &reference : references)
+        {
+            writeBinaryValue<uint32_t>(out, reference.from);
+            writeBinaryValue<uint32_t>(out, reference.to);
+            writeBinaryValue<uint64_t>(out, reference.count);
+        }
+    }
+
+    size_t MemoryManager::getAllocatedMemory() const
+    {
+        // objects waiting in allocation buffers of shared heap are counted in batches of TlabFlushBytes
+        return _allocatedMemory + _tlabBytes.load(std::memory_order_relaxed);
+    }
+
+    size_t MemoryManager::getObjectsCount() const { return _objectsRegister.size() - _sweepList.size(); }
+
+    size_t MemoryManager::getYoungMemory() const { return _youngMemory; }
+
+    void MemoryManager::setGenerationalMode(bool enabled)
+    {
+        if (_generational == enabled)
+        {
+            return;
+        }
+        // existing objects become old, the ones allocated outside chunks are scanned as roots by minor collections
+        _objectsRegister.forEach([this, enabled](IObjectHolder &objectHolder) {
+            objectHolder.promote();
+            if (enabled && !objectHolder.getChunk())
+            {
+                _untrackedObjects.insert(objectHolder.getObjectPtr());
+            }
+        });
+        for (auto &chunk : _chunks)
+        {
+            chunk->promote();
+        }
+        _youngObjects.clear();
+        _rememberedSet.clear();
+        _youngMemory = 0;
+        _generational = enabled;
+    }
+
+    bool MemoryManager::isGenerationalMode() const { return _generational; }
+
+    void MemoryManager::setCompactionMode(bool enabled) { _compaction = enabled; }
+
+    bool MemoryManager::isCompactionMode() const { return _compaction; }
+
+    void MemoryManager::enterScope()
+    {
+        if (!_shared)
+        {
+            _scopeDepth++;
+        }
+    }
+
+    size_t MemoryManager::leaveScope()
+    {
+        if (_shared || --_scopeDepth || _marking || _youngObjects.empty())
+        {
+            return 0;
+        }
+        return minorGarbageCollect();
+    }
+
+    void MemoryManager::setNurserySize(size_t bytes) { _nurserySize = bytes; }
+
+    size_t MemoryManager::getNurserySize() const { return _nurserySize; }
+
+    void MemoryManager::setIncrementalMode(bool enabled) { _incremental = enabled; }
+
+    bool MemoryManager::isIncrementalMode() const { return _incremental; }
+
+    void MemoryManager::setMarkSliceBudget(std::chrono::microseconds budget) { _markSliceBudget = budget; }
+
+    std::chrono::microseconds MemoryManager::getMarkSliceBudget() const { return _markSliceBudget; }
+
+    void MemoryManager::setMarkThreads(size_t threads)
+    {
+        _markThreads = std::max<size_t>(threads, 1);
+        if (_markThreads == 1)
+        {
+            _markHelpers.reset();
+        }
+        else if (!_markHelpers || _markHelpers->size() != _markThreads - 1)
+        {
+            _markHelpers = std::make_unique<MarkHelpers>(_markThreads - 1);
+        }
+    }
+
+    size_t MemoryManager::getMarkThreads() const { return _markThreads; }
+
+    void MemoryManager::setMarkStackCapacity(size_t capacity)
+    {
+        _markStackCapacity = std::max<size_t>(capacity, 1);
+        std::vector<void *>().swap(_markStack);
+    }
+
+    size_t MemoryManager::getMarkStackCapacity() const { return _markStackCapacity; }
+
+    void MemoryManager::setLazySweep(bool enabled)
+    {
+        _lazySweep = enabled;
+        if (!_lazySweep)
+        {
+            finishSweep();
+        }
+    }
+
+    bool MemoryManager::isLazySweep() const { return _lazySweep; }
+
+    void MemoryManager::setBackgroundSweep(bool enabled)
+    {
+        finishSweep();
+        _sweeper = enabled ? std::make_unique<BackgroundSweeper>() : nullptr;
+    }
+
+    bool MemoryManager::isBackgroundSweep() const { return !!_sweeper; }
+
+    void MemoryManager::waitForSweeper()
+    {
+        finishSweep();
+        if (_sweeper)
+        {
+            _sweeper->wait();
+        }
+    }
+
+    void MemoryManager::setFinalizerThread(bool enabled)
+    {
+        _finalizerThread = enabled ? std::make_unique<BackgroundSweeper>() : nullptr;
+    }
+
+    bool MemoryManager::isFinalizerThread() const { return !!_finalizerThread; }
+
+    size_t MemoryManager::runFinalizers(std::chrono::microseconds budget)
+    {
+        auto start = std::chrono::steady_clock::now();
+        size_t finalized = 0;
+        while (true)
+        {
+            std::unique_ptr<IObjectHolder> objectHolder;
+            {
+                std::lock_guard lock{_finalizersMutex};
+                if (_finalizationQueue.empty())
+                {
+                    break;
+                }
+                objectHolder = std::move(_finalizationQueue.front());
+                _finalizationQueue.pop_front();
+            }
+            objectHolder.reset(); // runs destructor outside of lock, it may allocate
+            finalized++;
+            auto elapsed = std::chrono::steady_clock::now() - start;
+            if (std::chrono::duration_cast<std::chrono::microseconds>(elapsed) >= budget)
+            {
+                break;
+            }
+        }
+        return finalized;
+    }
+
+    size_t MemoryManager::getPendingFinalizers()
+    {
+        std::lock_guard lock{_finalizersMutex};
+        return _finalizationQueue.size();
+    }
+
+    std::chrono::nanoseconds MemoryManager::getMaxPause() const { return _stats.pauses.max(); }
+
+    const MemoryManager::Stats &MemoryManager::stats() const { return _stats; }
+
+    void MemoryManager::resetStats() { _stats = Stats{}; }
+
+    void MemoryManager::setCollectionCallback(std::function<void(const CollectionStats &)> callback)
+    {
+        _collectionCallback = std::move(callback);
+    }
+
+    void MemoryManager::writeBarrier(void *slot, void *target)
+    {
+        if (!target || (!_marking && _youngObjects.empty()) || !_objectsRegister.isObjectRegistered(target))
+        {
+            return;
+        }
+        if (_marking && !_objectsRegister.getObjectHolder(target).isMarked())
+        {
+            // marked object may start pointing to unmarked one, shade it so it will be marked in this cycle
+            _markStack.push_back(target);
+        }
+        if (_youngObjects.empty())
+        {
+            return;
+        }
+        bool ownerYoung = true;
+        if (auto chunk = findChunk(slot); chunk && chunk->getCellSize())
+        {
+            // young objects share cell chunks with old ones, owner is the object whose cell holds slot
+            auto offset = static_cast<uint8_t *>(slot) - chunk->begin();
+            auto cell = chunk->begin() + offset - offset % chunk->getCellSize();
+            ownerYoung = _objectsRegister.isObjectRegistered(cell) ? _objectsRegister.getObjectHolder(cell).isYoung()
+                                                                   : !_tenuredConstructions;
+        }
+        else if (chunk)
+        {
+            ownerYoung = chunk->isYoung();
+        }
+        else if (auto largeObject = findLargeObject(slot))
+        {
+            ownerYoung = largeObject->isYoung();
+        }
+        if (ownerYoung || !_objectsRegister.getObjectHolder(target).isYoung())
+        {
+            return;
+        }
+        _rememberedSet.insert(reinterpret_cast<void **>(slot));
+    }
+
+    void MemoryManager::setPreciseRootsMode(bool enabled) { _preciseRoots = enabled; }
+
+    bool MemoryManager::isPreciseRootsMode() const { return _preciseRoots; }
+
+    void MemoryManager::setBlacklistingMode(bool enabled)
+    {
+        _blacklisting = enabled;
+        if (!enabled)
+        {
+            for (auto &chunk : _chunks)
+            {
+                chunk->clearBlacklist();
+            }
+        }
+    }
+
+    bool MemoryManager::isBlacklistingMode() const { return _blacklisting; }
+
+    std::unique_lock<std::recursive_mutex> MemoryManager::lockRoots()
+    {
+        // roots of shared heap are registered by many threads, managed objects holding roots or weak references are
+        // destroyed also by sweeper and finalizer threads
+        return std::unique_lock{_rootsMutex};
+    }
+
+    void MemoryManager::addRoot(RootNode &node)
+    {
+        auto lock = lockRoots();
+        node.manager = this;
+        node.prev = nullptr;
+        node.next = _roots;
+        if (_roots)
+        {
+            _roots->prev = &node;
+        }
+        _roots = &node;
+    }
+
+    void MemoryManager::removeRoot(RootNode &node)
+    {
+        auto lock = lockRoots();
+        (node.prev ? node.prev->next : _roots) = node.next;
+        if (node.next)
+        {
+            node.next->prev = node.prev;
+        }
+        node.manager = nullptr;
+        node.prev = node.next = nullptr;
+    }
+
+    void MemoryManager::addScanRange(ScanRange &range)
+    {
+        auto lock = lockRoots();
+        range.manager = this;
+        range.prev = nullptr;
+        range.next = _scanRanges;
+        if (_scanRanges)
+        {
+            _scanRanges->prev = &range;
+        }
+        _scanRanges = &range;
+    }
+
+    void MemoryManager::removeScanRange(ScanRange &range)
+    {
+        auto lock = lockRoots();
+        (range.prev ? range.prev->next : _scanRanges) = range.next;
+        if (range.next)
+        {
+            range.next->prev = range.prev;
+        }
+        range.manager = nullptr;
+        range.prev = range.next = nullptr;
+    }
+
+    void MemoryManager::addWeakSlot(WeakSlot &slot)
+    {
+        auto lock = lockRoots();
+        slot.manager = this;
+        _weakSlots.insert(&slot);
+    }
+
+    void MemoryManager::removeWeakSlot(WeakSlot &slot)
+    {
+        auto lock = lockRoots();
+        slot.manager = nullptr;
+        _weakSlots.erase(&slot);
+    }
+
+    void MemoryManager::addEphemeronTable(IEphemeronTable &table)
+    {
+        auto lock = lockRoots();
+        _ephemeronTables.insert(&table);
+    }
+
+    void MemoryManager::removeEphemeronTable(IEphemeronTable &table)
+    {
+        auto lock = lockRoots();
+        _ephemeronTables.erase(&table);
+    }
+
+    size_t MemoryManager::getMemoryLimit() const { return _memoryLimit; }
+
+    void MemoryManager::bumpMemoryLimit()
+    {
+        // limit chosen by pacing policy is kept until next collection consults it again, even if it is exceeded
+        if (!_pacingPolicy)
+        {
+            _memoryLimit *= 2;
+        }
+    }
+
+    void MemoryManager::updateMemoryLimit()
+    {
+        if (_pacingPolicy)
+        {
+            _memoryLimit = std::max<size_t>(_pacingPolicy->getMemoryLimit(getAllocatedMemory(), _memoryLimit), 1);
+        }
+        _pressureCollectionNeeded = false;
+        if (_memoryPressure)
+        {
+            // heap may take at most half of room left below process limit before next collection
+            auto room = _lastProcessLimit > _lastProcessMemory ? (_lastProcessLimit - _lastProcessMemory) / 2 : 0;
+            _memoryLimit = std::min(_memoryLimit, getAllocatedMemory() + std::max(room, MemoryPressureCheckInterval));
+        }
+    }
+
+    void MemoryManager::setMemoryPressureThreshold(double fraction)
+    {
+        if (fraction < 0 || fraction > 1)
+        {
+            throw std::runtime_error("Memory pressure threshold must be between 0 and 1");
+        }
+        _pressureThreshold = fraction;
+        _bytesUntilPressureCheck = MemoryPressureCheckInterval;
+        _nextPressureCheck = {};
+        _memoryPressure = false;
+        _pressureCollectionNeeded = false;
+        openPressureFile();
+    }
+
+    double MemoryManager::getMemoryPressureThreshold() const { return _pressureThreshold; }
+
+    void MemoryManager::setProcessMemoryLimit(size_t bytes)
+    {
+        _processMemoryLimit = bytes;
+        openPressureFile();
+    }
+
+    size_t MemoryManager::getProcessMemoryLimit() const { return _processMemoryLimit; }
+
+    bool MemoryManager::isUnderMemoryPressure() const { return _memoryPressure; }
+
+    void MemoryManager::countPressureBytes(size_t bytes)
+    {
+        // counting bytes only decides when clock is looked at, memory is read at most once per check period
+        if (bytes < _bytesUntilPressureCheck)
+        {
+            _bytesUntilPressureCheck -= bytes;
+            return;
+        }
+        _bytesUntilPressureCheck = MemoryPressureCheckInterval;
+        auto now = std::chrono::steady_clock::now();
+        if (now < _nextPressureCheck)
+        {
+            return;
+        }
+        _nextPressureCheck = now + MemoryPressureCheckPeriod;
+        checkMemoryPressure();
+    }
+
+    void MemoryManager::openPressureFile()
+    {
+        closePressureFile();
+        _cgroupLimit = 0;
+#ifdef LINUX
+        if (!_pressureThreshold)
+        {
+            return;
+        }
+        if (_processMemoryLimit)
+        {
+            _pressureFile = open("/proc/self/statm", O_RDONLY | O_CLOEXEC);
+            return;
+        }
+        if (_cgroupPath.empty())
+        {
+            _cgroupPath = findCgroupPath();
+        }
+        if (!_cgroupPath.empty())
+        {
+            auto maxFile = open((_cgroupPath + "/memory.max").c_str(), O_RDONLY | O_CLOEXEC);
+            if (maxFile >= 0)
+            {
+                _cgroupLimit = readFileValue(maxFile);
+                close(maxFile);
+            }
+            // without limit usage is never compared to anything
+            if (_cgroupLimit)
+            {
+                _pressureFile = open((_cgroupPath + "/memory.current").c_str(), O_RDONLY | O_CLOEXEC);
+            }
+        }
+#endif
+    }
+
+    void MemoryManager::closePressureFile()
+    {
+#ifdef LINUX
+        if (_pressureFile >= 0)
+        {
+            close(_pressureFile);
+        }
+#endif
+        _pressureFile = -1;
+    }
+
+    void MemoryManager::checkMemoryPressure()
+    {
+        size_t limit = 0, usage = 0;
+#ifdef LINUX
+        if (_pressureFile >= 0 && _processMemoryLimit)
+        {
+            // second value of statm is resident set size in pages
+            limit = _processMemoryLimit;
+            usage = readFileValue(_pressureFile, 1) * static_cast<size_t>(sysconf(_SC_PAGESIZE));
+        }
+        else if (_pressureFile >= 0)
+        {
+            // memory.current counts page cache too, but cgroup limit applies to it as well
+            limit = _cgroupLimit;
+            usage = readFileValue(_pressureFile);
+        }
+#endif
+        _lastProcessLimit = limit;
+        _lastProcessMemory = usage;
+        _memoryPressure = limit && usage > limit * _pressureThreshold;
+        if (_memoryPressure && !_pressureCollectionNeeded)
+        {
+            _pressureCollectionNeeded = true;
+            _stats.memoryPressureTriggers++;
+        }
+    }
+
+    void MemoryManager::setPacingPolicy(std::unique_ptr<IPacingPolicy> policy) { _pacingPolicy = std::move(policy); }
+
+    void MemoryManager::clear()
+    {
+        // objects handed over to sweeper or finalizers must be destroyed before chunks are freed
+        _sweeper.reset();
+        finishSweep();
+        _finalizerThread.reset();
+        runFinalizers();
+        // roots, weak references and tables outliving manager must not unregister from it
+        while (_roots)
+        {
+            removeRoot(*_roots);
+        }
+        while (_scanRanges)
+        {
+            removeScanRange(*_scanRanges);
+        }
+        for (auto slot : _weakSlots)
+        {
+            slot->hiddenPtr = hidePointer(nullptr);
+            slot->manager = nullptr;
+        }
+        _weakSlots.clear();
+        for (auto table : _ephemeronTables)
+        {
+            table->detach();
+        }
+        _ephemeronTables.clear();
+        _objectsRegister.forEach([this](IObjectHolder &objectHolder) { destroyObject(objectHolder); });
+        _objectsRegister.clear();
+        _largeObjects.clear();
+        _sampledObjects.clear();
+        _youngObjects.clear();
+        _rememberedSet.clear();
+        _untrackedObjects.clear();
+        _nurseryChunk = nullptr;
+        _tlabChunks = nullptr;
+        _cellChunks = {};
+        _partialChunks = {};
+        _chunksIndex.clear();
+        _chunks.clear();
+        _freeChunks.clear();
+        _reservedMemory = 0;
+        _residentMemory = 0;
+    }
+
+    void MemoryManager::destroyObject(IObjectHolder &objectHolder)
+    {
+        auto objectSize = objectHolder.getObjectSize();
+        if (!objectHolder.getChunk() && !_untrackedObjects.empty())
+        {
+            _untrackedObjects.erase(objectHolder.getObjectPtr());
+        }
+        if (!_sampledObjects.empty())
+        {
+            forgetSampledObject(objectHolder);
+        }
+        if (objectHolder.isLarge())
+        {
+            releaseLargeObject(objectHolder);
+        }
+        else
+        {
+            objectHolder.destroyObject();
+        }
+        _allocatedMemory -= objectSize;
+    }
+
+    void MemoryManager::setAllocationSampleInterval(size_t bytes)
+    {
+        _sampleInterval = bytes;
+        _bytesUntilSample = bytes;
+    }
+
+    size_t MemoryManager::getAllocationSampleInterval() const { return _sampleInterval; }
+
+    std::vector<MemoryManager::AllocationSite> MemoryManager::getAllocationSites() const
+    {
+        std::vector<AllocationSite> sites;
+        for (auto &sampledSite : _sampledSites)
+        {
+            sites.push_back({getTypeName(*sampledSite.type), getFrameNames(sampledSite.frames), sampledSite.samples,
+                             sampledSite.sampledBytes, sampledSite.estimatedBytes, sampledSite.liveSamples,
+                             sampledSite.liveBytes});
+        }
+        std::sort(sites.begin(), sites.end(), [](auto &a, auto &b) { return a.estimatedBytes > b.estimatedBytes; });
+        return sites;
+    }
+
+    void MemoryManager::resetAllocationSites()
+    {
+        _sampledSites.clear();
+        _sampledObjects.clear();
+    }
+
+    void MemoryManager::countSampledBytes(IObjectHolder &objectHolder)
+    {
+        auto objectSize = std::max<size_t>(objectHolder.getObjectSize(), 1);
+        if (objectSize < _bytesUntilSample)
+        {
+            _bytesUntilSample -= objectSize;
+            return;
+        }
+        _bytesUntilSample = _sampleInterval;
+        sampleAllocation(objectHolder, captureStack());
+    }
+
+    void MemoryManager::countSampledBytes(ThreadRecord &record, IObjectHolder &objectHolder)
+    {
+        auto objectSize = std::max<size_t>(objectHolder.getObjectSize(), 1);
+        if (!record.bytesUntilSample)
+        {
+            record.bytesUntilSample = _sampleInterval; // first allocation of thread
+        }
+        if (objectSize < record.bytesUntilSample)
+        {
+            record.bytesUntilSample -= objectSize;
+            return;
+        }
+        record.bytesUntilSample = _sampleInterval;
+        // site table is guarded by heap lock, so only stack is captured now
+        record.pendingSamples.emplace_back(&objectHolder, captureStack());
+    }
+
+    void MemoryManager::sampleAllocation(IObjectHolder &objectHolder, std::vector<void *> frames)
+    {
+        auto &type = objectHolder.getType();
+        auto it = std::find_if(_sampledSites.begin(), _sampledSites.end(),
+                               [&](auto &site) { return *site.type == type && site.frames == frames; });
+        if (it == _sampledSites.end())
+        {
+            it = _sampledSites.insert(_sampledSites.end(), SampledSite{&type, std::move(frames)});
+        }
+        auto objectSize = objectHolder.getObjectSize();
+        it->samples++;
+        it->sampledBytes += objectSize;
+        // sample stands for all bytes allocated since previous one
+        it->estimatedBytes += std::max(objectSize, _sampleInterval);
+        it->liveSamples++;
+        it->liveBytes += objectSize;
+        _sampledObjects[objectHolder.getObjectPtr()] = it - _sampledSites.begin();
+    }
+
+    void MemoryManager::forgetSampledObject(IObjectHolder &objectHolder)
+    {
+        auto it = _sampledObjects.find(objectHolder.getObjectPtr());
+        if (it == _sampledObjects.end())
+        {
+            return;
+        }
+        auto &site = _sampledSites[it->second];
+        site.liveSamples--;
+        site.liveBytes -= objectHolder.getObjectSize();
+        _sampledObjects.erase(it);
+    }
+
+    bool MemoryManager::isGBCollectionNeeded()
+    {
+        return getAllocatedMemory() > getMemoryLimit() || _pressureCollectionNeeded;
+    }
+
+    bool MemoryManager::isMinorCollectionNeeded()
+    {
+        // minor collections would interfere with mark bits of ongoing incremental marking
+        return (_generational || _scopeDepth) && !_marking && _youngMemory > _nurserySize;
+    }
+
+    void MemoryManager::collect(bool minor)
+    {
+        if (!isStackScannable())
+        {
+            // minor collection is retried anyway while nursery stays full
+            _collectionPending = _collectionPending || !minor;
+            return;
+        }
+        if (!minor)
+        {
+            _collectionPending = false;
+        }
+        auto start = std::chrono::steady_clock::now();
+        clearStack();
+        finishSweep();
+        if (!_marking)
+        {
+            _currentCollection = CollectionStats{minor};
+        }
+        // finishes ongoing incremental marking if any, marks set so far stay valid
+        auto markStart = std::chrono::steady_clock::now();
+        mark(minor);
+        auto sweepStart = std::chrono::steady_clock::now();
+        minor ? minorSweep() : sweep();
+        _marking = false;
+        _currentCollection.markTime += sweepStart - markStart;
+        _currentCollection.sweepTime += std::chrono::steady_clock::now() - sweepStart;
+        recordPause(start);
+        finishCollectionStats();
+    }
+
+    void MemoryManager::mark(bool minor)
+    {
+        pushRoots(minor);
+        if (_markThreads > 1)
+        {
+            parallelDrainMarkStack(minor);
+        }
+        else
+        {
+            drainMarkStack(minor);
+        }
+        processWeakReferences(minor);
+    }
+
+    void MemoryManager::pushRoots(bool minor)
+    {
+        if (_markStack.capacity() < _markStackCapacity)
+        {
+            _markStack.reserve(_markStackCapacity);
+        }
+        getRoots(_markStack);
+        if (minor && !_generational)
+        {
+            // objects created outside scopes were not covered by write barrier, they may point to scope objects
+            // through plain pointers, so all of them are scanned as roots
+            _objectsRegister.forEach([this](IObjectHolder &objectHolder) {
+                if (!objectHolder.isYoung())
+                {
+                    getInnerObjects(objectHolder, _markStack);
+                }
+            });
+        }
+        else if (minor)
+        {
+            for (auto slot : _rememberedSet)
+            {
+                if (_objectsRegister.isObjectRegistered(*slot))
+                {
+                    _markStack.push_back(*slot);
+                }
+            }
+            for (auto objectPtr : _untrackedObjects)
+            {
+                getInnerObjects(_objectsRegister.getObjectHolder(objectPtr), _markStack);
+            }
+        }
+    }
+
+    bool MemoryManager::drainMarkStack(bool minor, std::chrono::steady_clock::time_point deadline, size_t *workBytes)
+    {
+        size_t processed = 0;
+        while (!_markStack.empty() || _markStackOverflow)
+        {
+            if (workBytes && !*workBytes)
+            {
+                return false;
+            }
+            if (_markStack.empty())
+            {
+                rescanMarkedObjects(minor);
+                continue;
+            }
+            // checking clock is not free, do it once per batch of objects
+            if (++processed % 64 == 0 && std::chrono::steady_clock::now() > deadline)
+            {
+                return false;
+            }
+            auto ptr = _markStack.back();
+            _markStack.pop_back();
+            auto &objectHolder = _objectsRegister.getObjectHolder(ptr);
+
+            if ((minor && !objectHolder.isYoung()) || !objectHolder.tryMark())
+            {
+                continue;
+            }
+            pushChildren(objectHolder);
+            if (workBytes)
+            {
+                *workBytes -= std::min(*workBytes, objectHolder.getObjectSize());
+            }
+        }
+        return true;
+    }
+
+    void MemoryManager::pushChildren(const IObjectHolder &objectHolder, bool onlyUnmarked, bool minor)
+    {
+        // mark stack does not grow while marking, children which do not fit are found again by rescanMarkedObjects
+        forEachInnerObject(objectHolder, [&](void *p) {
+            if (onlyUnmarked)
+            {
+                auto &child = _objectsRegister.getObjectHolder(p);
+                if (child.isMarked() || (minor && !child.isYoung()))
+                {
+                    return;
+                }
+            }
+            if (_markStack.size() == _markStack.capacity())
+            {
+                _markStackOverflow = true;
+                return;
+            }
+            _markStack.push_back(p);
+        });
+    }
+
+    void MemoryManager::rescanMarkedObjects(bool minor)
+    {
+        _markStackOverflow = false;
+        _stats.markStackOverflows++;
+        // bigger stack is kept, so following collections of similar heap do not overflow again
+        _markStackCapacity = _markStack.capacity() * 2;
+        _markStack.reserve(_markStackCapacity);
+        auto pushUnmarkedChildren = [this, minor](const IObjectHolder &objectHolder) {
+            if (objectHolder.isMarked())
+            {
+                pushChildren(objectHolder, true, minor);
+            }
+        };
+        if (minor)
+        {
+            for (auto objectHolder : _youngObjects)
+            {
+                pushUnmarkedChildren(*objectHolder);
+            }
+        }
+        else
+        {
+            _objectsRegister.forEach(pushUnmarkedChildren);
+        }
+    }
+
+    void MemoryManager::parallelDrainMarkStack(bool minor)
+    {
+        constexpr size_t batchSize = 32;
+        auto threadsCount = _markThreads;
+        std::vector<MarkQueue> queues(threadsCount);
+        std::atomic<size_t> idleThreads = 0;
+
+        for (size_t i = 0; i < threadsCount; i++)
+        {
+            std::vector<void *> roots;
+            for (size_t j = i; j < _markStack.size(); j += threadsCount)
+            {
+                roots.push_back(_markStack[j]);
+            }
+            queues[i].push(roots, roots.size());
+        }
+        _markStack.clear();
+
+        auto worker = [&](size_t id) {
+            std::vector<void *> stack;
+            while (true)
+            {
+                if (stack.empty() && !queues[id].pop(stack, batchSize, false))
+                {
+                    bool stolen = false;
+                    for (size_t i = 1; i < threadsCount && !stolen; i++)
+                    {
+                        stolen = queues[(id + i) % threadsCount].pop(stack, batchSize, true);
+                    }
+                    if (!stolen)
+                    {
+                        // work may appear only in queues of threads that are still busy
+                        idleThreads++;
+                        while (idleThreads < threadsCount &&
+                               std::all_of(queues.begin(), queues.end(), [](auto &q) { return q.empty(); }))
+                        {
+                            std::this_thread::yield();
+                        }
+                        if (idleThreads == threadsCount)
+                        {
+                            return;
+                        }
+                        idleThreads--;
+                        continue;
+                    }
+                }
+                auto ptr = stack.back();
+                stack.pop_back();
+                auto &objectHolder = _objectsRegister.getObjectHolder(ptr);
+                if ((minor && !objectHolder.isYoung()) || !objectHolder.tryMark())
+                {
+                    continue;
+                }
+                getInnerObjects(objectHolder, stack);
+                if (stack.size() > 2 * batchSize && queues[id].empty())
+                {
+                    // share part of work so idle threads can steal it
+                    queues[id].push(stack, batchSize);
+                }
+            }
+        };
+
+        _markHelpers->runAll(worker);
+    }
+
+    void MemoryManager::startIncrementalCollection()
+    {
+        if (!isStackScannable())
+        {
+            _collectionPending = true;
+            return;
+        }
+        _collectionPending = false;
+        clearStack();
+        finishSweep();
+        _currentCollection = CollectionStats{};
+        _marking = true;
+        pushRoots(false);
+        // first slice runs right away, as if it was due
+        _markCredit = MarkSliceBytes;
+        incrementalMarkStep();
+    }
+
+    void MemoryManager::incrementalMarkStep()
+    {
+        auto start = std::chrono::steady_clock::now();
+        clearStack();
+        _stats.incrementalSlices++;
+        // work of slice follows allocation which made it due, so marking keeps pace with mutator without scanning
+        // for whole budget on each allocation, work left by slice stopped at deadline is owed by next one
+        auto workBytes = _markCredit * MarkWorkRatio;
+        auto finished = drainMarkStack(false, start + _markSliceBudget, &workBytes);
+        _markCredit = workBytes / MarkWorkRatio;
+        if (!finished)
+        {
+            _currentCollection.markTime += std::chrono::steady_clock::now() - start;
+            recordPause(start);
+            return;
+        }
+        if (!isStackScannable())
+        {
+            // marking is finished by first slice which runs on known stack
+            _currentCollection.markTime += std::chrono::steady_clock::now() - start;
+            recordPause(start);
+            return;
+        }
+        // stack was changing between slices, rescan it before sweeping
+        pushRoots(false);
+        drainMarkStack(false);
+        processWeakReferences(false);
+        auto sweepStart = std::chrono::steady_clock::now();
+        sweep();
+        _marking = false;
+        _currentCollection.markTime += sweepStart - start;
+        _currentCollection.sweepTime += std::chrono::steady_clock::now() - sweepStart;
+        recordPause(start);
+        finishCollectionStats();
+    }
+
+    void MemoryManager::markNewObject(IObjectHolder &objectHolder)
+    {
+        // objects are allocated marked, pointers passed to constructor may be not reachable from anything else
+        objectHolder.mark();
+        pushChildren(objectHolder);
+    }
+
+    void MemoryManager::processWeakReferences(bool minor)
+    {
+        auto lock = lockRoots();
+        auto isAlive = [this, minor](void *ptr) { return isAliveAfterMark(ptr, minor); };
+        if (!_ephemeronTables.empty())
+        {
+            auto scan = [this](const void *value, size_t size) {
+                auto begin = static_cast<uint8_t *>(const_cast<void *>(value));
+                scanStackRange(begin, begin + size, _markStack);
+            };
+            // values traced through live keys may make more keys live, repeat until nothing new is traced
+            _markEpoch++;
+            bool traced = true;
+            while (traced)
+            {
+                traced = false;
+                for (auto table : _ephemeronTables)
+                {
+                    traced |= table->traceValues(_markEpoch, isAlive, scan);
+                }
+                drainMarkStack(minor);
+            }
+            for (auto table : _ephemeronTables)
+            {
+                table->removeDeadEntries(isAlive);
+            }
+        }
+        for (auto slot : _weakSlots)
+        {
+            auto target = revealPointer(slot->hiddenPtr);
+            if (target && !isAliveAfterMark(target, minor))
+            {
+                slot->hiddenPtr = hidePointer(nullptr);
+            }
+        }
+    }
+
+    bool MemoryManager::isAliveAfterMark(void *ptr, bool minor) const
+    {
+        if (!_objectsRegister.isObjectRegistered(ptr))
+        {
+            return false;
+        }
+        // minor collections do not mark old objects
+        auto &objectHolder = _objectsRegister.getObjectHolder(ptr);
+        return objectHolder.isMarked() || (minor && !objectHolder.isYoung());
+    }
+
+    void MemoryManager::recordPause(std::chrono::steady_clock::time_point start)
+    {
+        auto pause = std::chrono::steady_clock::now() - start;
+        _stats.pauses.record(pause);
+        _stats.totalPause += pause;
+        _currentCollection.pause += pause;
+    }
+
+    void MemoryManager::finishCollectionStats()
+    {
+        _stats.collections++;
+        _stats.minorCollections += _currentCollection.minor;
+        _stats.freedBytes += _currentCollection.freedBytes;
+        _stats.freedObjects += _currentCollection.freedObjects;
+        _stats.movedBytes += _currentCollection.movedBytes;
+        _stats.totalMarkTime += _currentCollection.markTime;
+        _stats.totalSweepTime += _currentCollection.sweepTime;
+        _stats.lastCollection = _currentCollection;
+        if (_collectionCallback)
+        {
+            _collectionCallback(_stats.lastCollection);
+        }
+    }
+
+    void MemoryManager::sweep()
+    {
+        if (!_lazySweep && !_sweeper)
+        {
+            _objectsRegister.unregisterIf([this](IObjectHolder &objectHolder) {
+                if (objectHolder.isMarked())
+                {
+                    objectHolder.unmark();
+                    objectHolder.promote();
+                    _currentCollection.survivedObjects++;
+                    _currentCollection.survivedBytes += objectHolder.getObjectSize();
+                    return false;
+                }
+                else if (objectHolder.isFinalizable())
+                {
+                    // handed over to finalization queue by finishSweep
+                    sweepObject(objectHolder);
+                    return false;
+                }
+                else
+                {
+                    _currentCollection.freedObjects++;
+                    _currentCollection.freedBytes += objectHolder.getObjectSize();
+                    destroyObject(objectHolder);
+                    return true;
+                }
+            });
+        }
+        else
+        {
+            _objectsRegister.forEach([this](IObjectHolder &objectHolder) { sweepObject(objectHolder); });
+        }
+        if (_compaction && !_shared)
+        {
+            compact();
+        }
+        finishCollection();
+        updateMemoryLimit();
+    }
+
+    void MemoryManager::minorSweep()
+    {
+        for (auto objectHolder : _youngObjects)
+        {
+            sweepObject(*objectHolder);
+        }
+        finishCollection();
+    }
+
+    void MemoryManager::sweepObject(IObjectHolder &objectHolder)
+    {
+        if (objectHolder.isMarked())
+        {
+            objectHolder.unmark();
+            objectHolder.promote();
+            _currentCollection.survivedObjects++;
+            _currentCollection.survivedBytes += objectHolder.getObjectSize();
+        }
+        else
+        {
+            // memory is accounted as freed immediately, object will be destroyed by lazy sweep or sweeper thread
+            _allocatedMemory -= objectHolder.getObjectSize();
+            _currentCollection.freedObjects++;
+            _currentCollection.freedBytes += objectHolder.getObjectSize();
+            _sweepList.push_back(objectHolder.getObjectPtr());
+            if (!_sampledObjects.empty())
+            {
+                forgetSampledObject(objectHolder);
+            }
+            if (objectHolder.isLarge())
+            {
+                // large objects are unmapped right away, only their holders wait for sweep, finalizable ones are
+                // unmapped by their finalizer
+                releaseLargeObject(objectHolder, !objectHolder.isFinalizable());
+            }
+        }
+    }
+
+    void MemoryManager::compact()
+    {
+        // dead objects still take cells until swept
+        finishSweep();
+        auto lock = lockRoots();
+
+        // ambiguous references can not be updated, objects they point to pin whole chunks
+        std::vector<void *> ambiguousRefs;
+        std::unordered_set<Chunk *> pinnedChunks;
+        if (!_preciseRoots)
+        {
+            scanStacks(ambiguousRefs);
+        }
+        else
+        {
+            scanRanges(ambiguousRefs);
+        }
+        _objectsRegister.forEach([&](IObjectHolder &objectHolder) {
+            if (!objectHolder.isMovable())
+            {
+                pinnedChunks.insert(objectHolder.getChunk());
+            }
+            getInnerObjects(objectHolder, ambiguousRefs);
+        });
+        // keys of weak maps are hashed by address, values are scanned conservatively
+        auto epoch = ++_markEpoch;
+        for (auto table : _ephemeronTables)
+        {
+            table->traceValues(
+                epoch,
+                [&](void *key) {
+                    ambiguousRefs.push_back(key);
+                    return true;
+                },
+                [&](const void *begin, size_t size) {
+                    auto p = static_cast<uint8_t *>(const_cast<void *>(begin));
+                    scanStackRange(p, p + size, ambiguousRefs);
+                });
+        }
+        for (auto ptr : ambiguousRefs)
+        {
+            if (_objectsRegister.isObjectRegistered(ptr))
+            {
+                pinnedChunks.insert(_objectsRegister.getObjectHolder(ptr).getChunk());
+            }
+        }
+
+        std::unordered_set<Chunk *> evacuatedChunks;
+        for (auto &chunk : _chunks)
+        {
+            auto cellSize = chunk->getCellSize();
+            if (!cellSize || chunk->empty() || pinnedChunks.contains(chunk.get()) ||
+                chunk->getObjectsCount() * cellSize * 100 > chunk->size() * EvacuationOccupancy)
+            {
+                continue;
+            }
+            evacuatedChunks.insert(chunk.get());
+            auto &current = _cellChunks[getSizeClass(cellSize)];
+            if (current == chunk.get())
+            {
+                current = nullptr;
+            }
+        }
+        if (evacuatedChunks.empty())
+        {
+            return;
+        }
+        // partial chunks are collected again by reclaimChunks, now they could hand out cells of evacuated chunks
+        for (auto &partial : _partialChunks)
+        {
+            partial.clear();
+        }
+
+        // objects are moved in order of roots, so objects of nearby roots end up next to each other
+        std::unordered_map<void *, void *> forwarding;
+        for (auto node = _roots; node; node = node->next)
+        {
+            auto ptr = *node->slot;
+            if (auto it = forwarding.find(ptr); it != forwarding.end())
+            {
+                *node->slot = it->second;
+                continue;
+            }
+            if (!_objectsRegister.isObjectRegistered(ptr) ||
+                !evacuatedChunks.contains(_objectsRegister.getObjectHolder(ptr).getChunk()))
+            {
+                continue;
+            }
+            auto objectHolder = _objectsRegister.releaseObject(ptr);
+            auto sizeClass = getSizeClass(objectHolder->getChunk()->getCellSize());
+            while (!objectHolder->moveTo(getCellChunk(sizeClass)))
+            {
+                // all free cells left in chunk were on blacklisted pages
+                _cellChunks[sizeClass] = nullptr;
+            }
+            *node->slot = forwarding[ptr] = objectHolder->getObjectPtr();
+            _currentCollection.movedObjects++;
+            _currentCollection.movedBytes += objectHolder->getObjectSize();
+            _objectsRegister.registerObject(std::move(objectHolder));
+        }
+        if (forwarding.empty())
+        {
+            return;
+        }
+        for (auto slot : _weakSlots)
+        {
+            if (auto it = forwarding.find(revealPointer(slot->hiddenPtr)); it != forwarding.end())
+            {
+                slot->hiddenPtr = hidePointer(it->second);
+            }
+        }
+        for (auto &[from, to] : forwarding)
+        {
+            if (auto node = _sampledObjects.extract(from))
+            {
+                node.key() = to;
+                _sampledObjects.insert(std::move(node));
+            }
+        }
+    }
+
+    void MemoryManager::finishCollection()
+    {
+        // all survivors are promoted, so are chunks they live in
+        for (auto &chunk : _chunks)
+        {
+            chunk->promote();
+        }
+        _youngObjects.clear();
+        _rememberedSet.clear();
+        _youngMemory = 0;
+        _chunksReclaimNeeded = true;
+        if (!_lazySweep)
+        {
+            finishSweep();
+        }
+    }
+
+    void MemoryManager::sweepStep(size_t count)
+    {
+        std::vector<std::unique_ptr<IObjectHolder>> deadObjects, finalizableObjects;
+        while (count-- && !_sweepList.empty())
+        {
+            auto objectPtr = _sweepList.back();
+            _sweepList.pop_back();
+            auto objectHolder = _objectsRegister.releaseObject(objectPtr);
+            if (!objectHolder->getChunk() && !_untrackedObjects.empty())
+            {
+                _untrackedObjects.erase(objectPtr);
+            }
+            if (objectHolder->isFinalizable())
+            {
+                finalizableObjects.push_back(std::move(objectHolder));
+            }
+            else if (_sweeper)
+            {
+                deadObjects.push_back(std::move(objectHolder));
+            }
+        }
+        if (!deadObjects.empty())
+        {
+            _sweeper->enqueue(deadObjects);
+        }
+        if (!finalizableObjects.empty())
+        {
+            enqueueFinalizers(finalizableObjects);
+        }
+        if (_sweepList.empty() && _chunksReclaimNeeded)
+        {
+            _chunksReclaimNeeded = false;
+            reclaimChunks();
+        }
+    }
+
+    void MemoryManager::finishSweep() { sweepStep(_sweepList.size()); }
+
+    void MemoryManager::enqueueFinalizers(std::vector<std::unique_ptr<IObjectHolder>> &objectHolders)
+    {
+        if (_finalizerThread)
+        {
+            _finalizerThread->enqueue(objectHolders);
+            return;
+        }
+        std::lock_guard lock{_finalizersMutex};
+        std::move(objectHolders.begin(), objectHolders.end(), std::back_inserter(_finalizationQueue));
+        objectHolders.clear();
+    }
+
+    MemoryManager::Chunk &MemoryManager::allocateChunk(size_t minSize, size_t cellSize)
+    {
+        std::unique_ptr<Chunk> chunkPtr;
+        if (minSize <= Chunk::Size && !_freeChunks.empty())
+        {
+            // most recently freed chunks are most likely still committed
+            chunkPtr = std::move(_freeChunks.back());
+            _freeChunks.pop_back();
+            if (!chunkPtr->isCommitted())
+            {
+                chunkPtr->commit();
+                _residentMemory += chunkPtr->size();
+            }
+        }
+        else
+        {
+            chunkPtr = std::make_unique<Chunk>(minSize);
+            _reservedMemory += chunkPtr->size();
+            _residentMemory += chunkPtr->size();
+            for (auto p = chunkPtr->begin(); p < chunkPtr->end(); p += Chunk::Size)
+            {
+                _chunksIndex[reinterpret_cast<uintptr_t>(p)] = chunkPtr.get();
+            }
+        }
+        chunkPtr->reset(cellSize);
+        return *_chunks.emplace_back(std::move(chunkPtr));
+    }
+
+    MemoryManager::Chunk &MemoryManager::getCellChunk(size_t sizeClass)
+    {
+        auto &current = _cellChunks[sizeClass];
+        if (current && current->hasFreeCells())
+        {
+            return *current;
+        }
+        auto &partial = _partialChunks[sizeClass];
+        while (!partial.empty())
+        {
+            current = partial.back();
+            partial.pop_back();
+            if (current->hasFreeCells())
+            {
+                return *current;
+            }
+        }
+        if (!_sweepList.empty())
+        {
+            // pending sweep may free cells in existing chunks
+            finishSweep();
+            return getCellChunk(sizeClass);
+        }
+        current = &allocateChunk(Chunk::Size, getCellSize(sizeClass));
+        return *current;
+    }
+
+    size_t MemoryManager::getSizeClass(size_t size)
+    {
+        if (size <= 256)
+        {
+            // 16 byte steps up to 256
+            return (std::max<size_t>(size, 1) - 1) / 16;
+        }
+        // 4 classes for each power of two up to MaxCellSize
+        auto exponent = std::bit_width(size - 1) - 1;
+        return 16 + (exponent - 8) * 4 + ((size - 1) >> (exponent - 2)) - 4;
+    }
+
+    size_t MemoryManager::getCellSize(size_t sizeClass)
+    {
+        if (sizeClass < 16)
+        {
+            return (sizeClass + 1) * 16;
+        }
+        auto exponent = (sizeClass - 16) / 4 + 8;
+        return (size_t{4} + (sizeClass - 16) % 4 + 1) << (exponent - 2);
+    }
+
+    MemoryManager::Chunk *MemoryManager::findChunk(void *ptr) const
+    {
+        auto it = _chunksIndex.find(reinterpret_cast<uintptr_t>(ptr) & ~(Chunk::Size - 1));
+        return it != _chunksIndex.end() ? it->second : nullptr;
+    }
+
+    size_t MemoryManager::getReservedMemory() const { return _reservedMemory; }
+
+    size_t MemoryManager::getResidentMemory() const { return _residentMemory; }
+
+    void MemoryManager::reclaimChunks()
+    {
+        for (auto &partial : _partialChunks)
+        {
+            partial.clear();
+        }
+        std::erase_if(_chunks, [this](std::unique_ptr<Chunk> &chunk) {
+            auto cellSize = chunk->getCellSize();
+            auto isCurrent =
+                chunk.get() == _nurseryChunk || (cellSize && chunk.get() == _cellChunks[getSizeClass(cellSize)]);
+            if (chunk->empty() && isCurrent)
+            {
+                chunk->reset(cellSize);
+                return false;
+            }
+            if (!chunk->empty())
+            {
+                if (cellSize && !isCurrent && chunk->hasFreeCells())
+                {
+                    _partialChunks[getSizeClass(cellSize)].push_back(chunk.get());
+                }
+                return false;
+            }
+            if (chunk->size() > Chunk::Size)
+            {
+                // spans of many chunks are not reused
+                for (auto p = chunk->begin(); p < chunk->end(); p += Chunk::Size)
+                {
+                    _chunksIndex.erase(reinterpret_cast<uintptr_t>(p));
+                }
+                _reservedMemory -= chunk->size();
+                _residentMemory -= chunk->size();
+                return true;
+            }
+            _freeChunks.push_back(std::move(chunk));
+            return true;
+        });
+        releaseFreeChunks();
+    }
+
+    void MemoryManager::releaseFreeChunks()
+    {
+        // chunks free for a while are decommitted, the oldest ones above limit are unmapped
+        for (auto &chunk : _freeChunks)
+        {
+            if (chunk->ageFree() >= DecommitDelay && chunk->isCommitted())
+            {
+                chunk->decommit();
+                _residentMemory -= chunk->size();
+            }
+        }
+        if (_freeChunks.size() <= MaxFreeChunks)
+        {
+            return;
+        }
+        auto toRelease = _freeChunks.size() - MaxFreeChunks;
+        for (auto it = _freeChunks.begin(); it != _freeChunks.begin() + toRelease; it++)
+        {
+            auto &chunk = *it;
+            for (auto p = chunk->begin(); p < chunk->end(); p += Chunk::Size)
+            {
+                _chunksIndex.erase(reinterpret_cast<uintptr_t>(p));
+            }
+            _reservedMemory -= chunk->size();
+            _residentMemory -= chunk->isCommitted() ? chunk->size() : 0;
+        }
+        _freeChunks.erase(_freeChunks.begin(), _freeChunks.begin() + toRelease);
+    }
+
+    void *MemoryManager::mapLargeObject(size_t size) { return mapMemory(getLargeObjectMappedSize(size), PageSize); }
+
+    void MemoryManager::unmapLargeObject(void *objectPtr, size_t size)
+    {
+        unmapMemory(static_cast<uint8_t *>(objectPtr), getLargeObjectMappedSize(size));
+    }
+
+    size_t MemoryManager::getLargeObjectMappedSize(size_t size) { return (size + PageSize - 1) / PageSize * PageSize; }
+
+    MemoryManager::IObjectHolder *MemoryManager::findLargeObject(void *ptr) const
+    {
+        auto address = reinterpret_cast<uintptr_t>(ptr);
+        auto it = _largeObjects.upper_bound(address);
+        if (it == _largeObjects.begin())
+        {
+            return nullptr;
+        }
+        it--;
+        return address < it->first + it->second->getObjectSize() ? it->second : nullptr;
+    }
+
+    void MemoryManager::releaseLargeObject(IObjectHolder &objectHolder, bool destroy)
+    {
+        auto mappedSize = getLargeObjectMappedSize(objectHolder.getObjectSize());
+        _largeObjects.erase(reinterpret_cast<uintptr_t>(objectHolder.getObjectPtr()));
+        _reservedMemory -= mappedSize;
+        _residentMemory -= mappedSize;
+        if (destroy)
+        {
+            objectHolder.destroyObject();
+        }
+    }
+
+    void MemoryManager::getRoots(std::vector<void *> &result)
+    {
+        {
+            auto lock = lockRoots();
+            for (auto node = _roots; node; node = node->next)
+            {
+                if (_objectsRegister.isObjectRegistered(*node->slot))
+                {
+                    result.emplace_back(*node->slot);
+                }
+            }
+        }
+        if (_blacklisting)
+        {
+            // blacklist is rebuilt from values found in current scan
+            for (auto &chunk : _chunks)
+            {
+                chunk->clearBlacklist();
+            }
+        }
+        auto explicitRoots = result.size();
+        if (!_preciseRoots)
+        {
+            scanStacks(result);
+        }
+        else
+        {
+            scanRanges(result);
+        }
+        _currentCollection.ambiguousRoots = result.size() - explicitRoots;
+        if (_blacklisting)
+        {
+            size_t blacklistedPages = 0;
+            for (auto &chunk : _chunks)
+            {
+                blacklistedPages += chunk->getBlacklistedPages();
+            }
+            _currentCollection.blacklistedPages = blacklistedPages;
+        }
+    }
+
+    bool MemoryManager::isStackScannable()
+    {
+        if (_preciseRoots)
+        {
+            return true;
+        }
+        auto [top, bot, rsp] = getStackBounds();
+        if (rsp >= bot && rsp < top)
+        {
+            return true;
+        }
+        // frames of fiber can be found only through range registered for its stack
+        auto lock = lockRoots();
+        for (auto range = _scanRanges; range; range = range->next)
+        {
+            if (rsp >= range->begin && rsp < range->end)
+            {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void MemoryManager::scanStacks(std::vector<void *> &result)
+    {
+        // push local variables  stored in registers onto the stack.
+        jmp_buf jb;
+        setjmp(jb);
+
+        auto [top, bot, rsp] = getStackBounds();
+
+        if (rsp >= bot && rsp < top)
+        {
+            scanStackRange(rsp, top, result);
+        }
+        else
+        {
+            // running on fiber stack, only part above stack pointer holds live frames
+            auto lock = lockRoots();
+            auto range = _scanRanges;
+            while (range && !(rsp >= range->begin && rsp < range->end))
+            {
+                range = range->next;
+            }
+            // collections are not started on stacks which are not registered, see isStackScannable
+            if (range)
+            {
+                scanStackRange(rsp, static_cast<uint8_t *>(range->end) - sizeof(void *) + 1, result);
+            }
+        }
+        scanRanges(result, rsp);
+        // stacks of other threads registered in shared heap, they are parked or in safe region now
+        for (auto record : _threads)
+        {
+            if (record->stackPointer && record != currentThread())
+            {
+                scanStackRange(record->stackPointer, record->stackTop, result);
+            }
+        }
+    }
+
+    void MemoryManager::scanRanges(std::vector<void *> &result, const uint8_t *stackPointer)
+    {
+        auto lock = lockRoots();
+        for (auto range = _scanRanges; range; range = range->next)
+        {
+            auto begin = static_cast<uint8_t *>(range->begin), end = static_cast<uint8_t *>(range->end);
+            // range of running fiber was already scanned from stack pointer
+            if (begin + sizeof(void *) <= end && !(stackPointer >= begin && stackPointer < end))
+            {
+                // last pointer read must end within range
+                scanStackRange(begin, end - sizeof(void *) + 1, result);
+            }
+        }
+    }
+
+    void MemoryManager::scanStackRange(uint8_t *begin, uint8_t *end, std::vector<void *> &result) const
+    {
+        while (begin < end)
+        {
+            auto address = (void *)*reinterpret_cast<void **>(begin);
+            if (_objectsRegister.isObjectRegistered(address))
+            {
+                result.emplace_back(address);
+            }
+            else if (_blacklisting && reinterpret_cast<uintptr_t>(begin) % alignof(void *) == 0)
+            {
+                blacklistAddress(address);
+            }
+            begin++;
+        }
+    }
+
+    void MemoryManager::blacklistAddress(void *address) const
+    {
+        if (auto chunk = findChunk(address); chunk && address >= chunk->begin() && address < chunk->end())
+        {
+            chunk->blacklist(address);
+        }
+    }
+
+    void MemoryManager::getInnerObjects(const IObjectHolder &objectHolder, std::vector<void *> &result) const
+    {
+        forEachInnerObject(objectHolder, [&](void *p) { result.push_back(p); });
+    }
+
+    template <class Fn> void MemoryManager::forEachInnerObject(const IObjectHolder &objectHolder, Fn &&func) const
+    {
+        if (objectHolder.isPointerFree())
+        {
+            return;
+        }
+        auto p = (uint8_t *)objectHolder.getObjectPtr();
+        auto end = (p + objectHolder.getObjectSize());
+        auto step = objectHolder.getScanStep();
+        // do not read past object end, cell may be last one in mapped chunk
+        while (p + sizeof(void *) <= end)
+        {
+            auto address = (void *)*reinterpret_cast<void **>(p);
+            if (_objectsRegister.isObjectRegistered(address))
+            {
+                func(address);
             }
-            p++;
+            p += step;
         }
-        return result;
     }
 } // namespace sd
\ No newline at end of file
@@ -1,5 +1,6 @@
 #pragma once
 #include <iostream>
+#include <memory>
 #include <string>
 
 namespace sd
@@ -133,15 +134,22 @@ namespace sd
         const T *operator->() const { return &_ptr->getItem(); }
     };
 
-    template <class T> class List
+    /**
+     * Doubly linked list, nodes are allocated with Allocator rebound to node type. Nodes of garbage collected allocator
+     * (sd::GcAllocator) are not destroyed with list, collector reclaims them once they are unreachable
+     */
+    template <class T, class Allocator = std::allocator<T>> class List
     {
       private:
         using NodePtr = ListNode<T> *;
         using ConstNodePtr = const ListNode<T> *;
+        using NodeAllocator = typename std::allocator_traits<Allocator>::template rebind_alloc<ListNode<T>>;
+        using NodeTraits = std::allocator_traits<NodeAllocator>;
 
         NodePtr _head = nullptr;
         NodePtr _tail = nullptr;
         size_t _size = 0;
+        [[no_unique_address]] NodeAllocator _allocator;
 
       public:
         using Iterator = ListIterator<T, false>;
@@ -169,7 +177,7 @@ namespace sd
             }
         }
 
-        List(const List<T> &other)
+        List(const List<T, Allocator> &other)
         {
             auto end = other.end();
             for (auto it = other.begin(); it != end; ++it)
@@ -178,7 +186,7 @@ namespace sd
             }
         }
 
-        List(List<T> &&other)
+        List(List<T, Allocator> &&other)
         {
             _head = other._head;
             _tail = other._tail;
@@ -197,10 +205,17 @@ namespace sd
             }
         }
 
-        ~List() { clear(); }
+        ~List()
+        {
+            // collected nodes could be already reclaimed if list is destroyed by collector
+            if constexpr (!requires { Allocator::isGarbageCollected; })
+            {
+                clear();
+            }
+        }
 
         // Assign
-        List<T> &operator=(const List<T> &other)
+        List<T, Allocator> &operator=(const List<T, Allocator> &other)
         {
             clear();
             auto end = other.end();
@@ -211,7 +226,7 @@ namespace sd
             return *this;
         }
 
-        List<T> &operator=(List<T> &&other)
+        List<T, Allocator> &operator=(List<T, Allocator> &&other)
         {
             clear();
             _head = other._head;
@@ -223,7 +238,7 @@ namespace sd
             return *this;
         }
 
-        List<T> &operator=(std::initializer_list<T> ilist)
+        List<T, Allocator> &operator=(std::initializer_list<T> ilist)
         {
             clear();
             auto end = ilist.end();
@@ -311,7 +326,7 @@ namespace sd
             removeNode(size() - 1);
         }
 
-        void swap(List<T> &other)
+        void swap(List<T, Allocator> &other)
         {
             auto tmp{std::move(*this)};
             *this = std::move(other);
@@ -494,35 +509,60 @@ namespace sd
             }
         }
 
-        NodePtr makeNode(const T &item) { return new ListNode<T>(item); }
+        NodePtr makeNode(const T &item) { return constructNode(item); }
+
+        NodePtr makeNode(T &&item) { return constructNode(std::move(item)); }
 
-        NodePtr makeNode(T &&item) { return new ListNode<T>(std::move(item)); }
+        template <class... Types> NodePtr makeNodeWithItem(Types... args) { return constructNode(args...); }
 
-        template <class... Types> NodePtr makeNodeWithItem(Types... args) { return new ListNode<T>(args...); }
+        template <class... Args> NodePtr constructNode(Args &&...args)
+        {
+            auto ptr = NodeTraits::allocate(_allocator, 1);
+            try
+            {
+                NodeTraits::construct(_allocator, ptr, std::forward<Args>(args)...);
+            }
+            catch (...)
+            {
+                NodeTraits::deallocate(_allocator, ptr, 1);
+                throw;
+            }
+            return ptr;
+        }
 
-        void deleteNode(NodePtr ptr) { delete ptr; }
+        void deleteNode(NodePtr ptr)
+        {
+            NodeTraits::destroy(_allocator, ptr);
+            NodeTraits::deallocate(_allocator, ptr, 1);
+        }
     };
 
-    template <class T> bool operator==(const List<T> &lhs, const List<T> &rhs)
+    template <class T, class A> bool operator==(const List<T, A> &lhs, const List<T, A> &rhs)
     {
         return std::equal(lhs.begin(), lhs.end(), rhs.begin(), rhs.end());
     }
 
-    template <class T> bool operator!=(const List<T> &lhs, const List<T> &rhs) { return !(lhs == rhs); }
+    template <class T, class A> bool operator!=(const List<T, A> &lhs, const List<T, A> &rhs) { return !(lhs == rhs); }
 
-    template <class T> bool operator<(const List<T> &lhs, const List<T> &rhs)
+    template <class T, class A> bool operator<(const List<T, A> &lhs, const List<T, A> &rhs)
     {
         return std::lexicographical_compare(lhs.begin(), lhs.end(), rhs.begin(), rhs.end());
     }
 
-    template <class T> bool operator<=(const List<T> &lhs, const List<T> &rhs) { return lhs < rhs || lhs == rhs; }
+    template <class T, class A> bool operator<=(const List<T, A> &lhs, const List<T, A> &rhs)
+    {
+        return lhs < rhs || lhs == rhs;
+    }
 
-    template <class T> bool operator>(const List<T> &lhs, const List<T> &rhs)
+    template <class T, class A> bool operator>(const List<T, A> &lhs, const List<T, A> &rhs)
     {
         return std::lexicographical_compare(rhs.begin(), rhs.end(), lhs.begin(), lhs.end());
     }
 
-    template <class T> bool operator>=(const List<T> &lhs, const List<T> &rhs) { return lhs > rhs || lhs == rhs; }
+    template <class T, class A> bool operator>=(const List<T, A> &lhs, const List<T, A> &rhs)
+    {
+        return lhs > rhs || lhs == rhs;
+    }
 
     void linkedMain();
 
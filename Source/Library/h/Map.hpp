@@ -1,5 +1,6 @@
 #pragma once
 #include <iostream>
+#include <memory>
 #include <tuple>
 #include <utility>
 
@@ -79,9 +80,10 @@ namespace sd
         void setColor(Color color) { _color = color; }
     };
 
-    template <class K, class T> class Map;
+    template <class K, class T, class Allocator = std::allocator<std::pair<const K, T>>> class Map;
 
-    template <class K, class T, bool C, bool R> // C= const, R = Reverse
+    template <class K, class T, bool C, bool R, // C= const, R = Reverse
+              class Allocator = std::allocator<std::pair<const K, T>>>
     class MapIterator
     {
       public:
@@ -97,21 +99,27 @@ namespace sd
 
       protected:
         MapNodePtr _ptr = nullptr;
-        const Map<K, T> *const _parentMap;
+        const Map<K, T, Allocator> *const _parentMap;
 
       public:
-        MapIterator(const Map<K, T> *const parentMap, MapNodePtr ptr) : _parentMap(parentMap) { _ptr = ptr; }
-        MapIterator(const MapIterator<K, T, C, R> &rawIterator) = default;
+        MapIterator(const Map<K, T, Allocator> *const parentMap, MapNodePtr ptr) : _parentMap(parentMap) { _ptr = ptr; }
+        MapIterator(const MapIterator<K, T, C, R, Allocator> &rawIterator) = default;
         ~MapIterator() = default;
 
-        MapIterator<K, T, C, R> &operator=(const MapIterator<K, T, C, R> &rawIterator) = default;
+        MapIterator<K, T, C, R, Allocator> &operator=(const MapIterator<K, T, C, R, Allocator> &rawIterator) = default;
 
         operator bool() const { return !_parentMap->isGuard(_ptr); }
 
-        bool operator==(const MapIterator<K, T, C, R> &rawIterator) const { return _ptr == rawIterator._ptr; }
-        bool operator!=(const MapIterator<K, T, C, R> &rawIterator) const { return _ptr != rawIterator._ptr; }
+        bool operator==(const MapIterator<K, T, C, R, Allocator> &rawIterator) const
+        {
+            return _ptr == rawIterator._ptr;
+        }
+        bool operator!=(const MapIterator<K, T, C, R, Allocator> &rawIterator) const
+        {
+            return _ptr != rawIterator._ptr;
+        }
 
-        MapIterator<K, T, C, R> &operator++()
+        MapIterator<K, T, C, R, Allocator> &operator++()
         {
 
             if constexpr (R)
@@ -126,7 +134,7 @@ namespace sd
             return (*this);
         }
 
-        MapIterator<K, T, C, R> &operator--()
+        MapIterator<K, T, C, R, Allocator> &operator--()
         {
             if constexpr (R)
             {
@@ -139,14 +147,14 @@ namespace sd
             return (*this);
         }
 
-        MapIterator<K, T, C, R> operator++(int)
+        MapIterator<K, T, C, R, Allocator> operator++(int)
         {
             auto temp(*this);
             ++*this;
             return temp;
         }
 
-        MapIterator<K, T, C, R> operator--(int)
+        MapIterator<K, T, C, R, Allocator> operator--(int)
         {
             auto temp(*this);
             --*this;
@@ -225,16 +233,22 @@ namespace sd
         }
     };
 
-    template <class K, class T> class Map
+    /**
+     * Red black tree map, nodes are allocated with Allocator rebound to node type. Nodes of garbage collected
+     * allocator (sd::GcAllocator) are not destroyed with map, collector reclaims them once they are unreachable
+     */
+    template <class K, class T, class Allocator> class Map
     {
       private:
-        friend class MapIterator<K, T, false, false>;
-        friend class MapIterator<K, T, true, false>;
-        friend class MapIterator<K, T, false, true>;
-        friend class MapIterator<K, T, true, true>;
+        friend class MapIterator<K, T, false, false, Allocator>;
+        friend class MapIterator<K, T, true, false, Allocator>;
+        friend class MapIterator<K, T, false, true, Allocator>;
+        friend class MapIterator<K, T, true, true, Allocator>;
 
         using MapNodePtr = MapNode<K, T> *;
         using ConstMapNodePtr = const MapNode<K, T> *;
+        using NodeAllocator = typename std::allocator_traits<Allocator>::template rebind_alloc<MapNode<K, T>>;
+        using NodeTraits = std::allocator_traits<NodeAllocator>;
 
         using Pair = std::pair<const K, T>;
 
@@ -242,22 +256,23 @@ namespace sd
         MapNodePtr _guardPtr = reinterpret_cast<MapNodePtr>(&_guard);
         MapNodePtr _root = _guardPtr;
         size_t _size = 0;
+        [[no_unique_address]] NodeAllocator _allocator;
 
       public:
-        using Iterator = MapIterator<K, T, false, false>;
-        using ConstIterator = MapIterator<K, T, true, false>;
+        using Iterator = MapIterator<K, T, false, false, Allocator>;
+        using ConstIterator = MapIterator<K, T, true, false, Allocator>;
 
-        using ReverseIterator = MapIterator<K, T, false, true>;
-        using ConstReverseIterator = MapIterator<K, T, true, true>;
+        using ReverseIterator = MapIterator<K, T, false, true, Allocator>;
+        using ConstReverseIterator = MapIterator<K, T, true, true, Allocator>;
 
         // Constructors
         Map() = default;
 
         template <class InputIt> Map(InputIt first, InputIt last) { insert(first, last); }
 
-        Map(const Map<K, T> &other) { insert(other.begin(), other.end()); }
+        Map(const Map<K, T, Allocator> &other) { insert(other.begin(), other.end()); }
 
-        Map(Map<K, T> &&other)
+        Map(Map<K, T, Allocator> &&other)
         {
             _root = other._root;
             _size = other._size;
@@ -268,17 +283,24 @@ namespace sd
 
         Map(std::initializer_list<Pair> init) { insert(init); }
 
-        ~Map() { clear(); }
+        ~Map()
+        {
+            // collected nodes could be already reclaimed if map is destroyed by collector
+            if constexpr (!requires { Allocator::isGarbageCollected; })
+            {
+                clear();
+            }
+        }
 
         // Assign
-        Map<K, T> &operator=(const Map<K, T> &other)
+        Map<K, T, Allocator> &operator=(const Map<K, T, Allocator> &other)
         {
             clear();
             insert(other.begin(), other.end());
             return *this;
         }
 
-        Map<K, T> &operator=(Map<K, T> &&other)
+        Map<K, T, Allocator> &operator=(Map<K, T, Allocator> &&other)
         {
             clear();
             _root = other._root;
@@ -289,7 +311,7 @@ namespace sd
             return *this;
         }
 
-        Map<K, T> &operator=(std::initializer_list<Pair> ilist)
+        Map<K, T, Allocator> &operator=(std::initializer_list<Pair> ilist)
         {
             clear();
             insert(ilist);
@@ -349,7 +371,7 @@ namespace sd
             removeNode(node);
         }
 
-        void swap(Map<K, T> &other)
+        void swap(Map<K, T, Allocator> &other)
         {
             auto tmp{std::move(*this)};
             *this = std::move(other);
@@ -806,13 +828,28 @@ namespace sd
 
         bool isGuard(ConstMapNodePtr const ptr) const { return ptr == _guardPtr; }
 
-        MapNodePtr makeNode(const K &key, const T &item) { return new MapNode<K, T>(key, item); }
+        MapNodePtr makeNode(const K &key, const T &item) { return constructNode(key, item); }
 
-        MapNodePtr makeNode(K &&key, T &&item) { return new MapNode<K, T>(std::move(key), std::move(item)); }
+        MapNodePtr makeNode(K &&key, T &&item) { return constructNode(std::move(key), std::move(item)); }
 
-        MapNodePtr makeNode(Pair &&pair) { return new MapNode<K, T>(std::move(pair)); }
+        MapNodePtr makeNode(Pair &&pair) { return constructNode(std::move(pair)); }
 
-        MapNodePtr makeNode(const Pair &pair) { return new MapNode<K, T>(pair); }
+        MapNodePtr makeNode(const Pair &pair) { return constructNode(pair); }
+
+        template <class... Args> MapNodePtr constructNode(Args &&...args)
+        {
+            auto ptr = NodeTraits::allocate(_allocator, 1);
+            try
+            {
+                NodeTraits::construct(_allocator, ptr, std::forward<Args>(args)...);
+            }
+            catch (...)
+            {
+                NodeTraits::deallocate(_allocator, ptr, 1);
+                throw;
+            }
+            return ptr;
+        }
 
         // template <class... Args1, class... Args2>
         // MapNodePtr makeNodeWithItem(std::tuple<Args1...> args1,
@@ -821,32 +858,39 @@ namespace sd
         //     return new MapNode<K, T>(args1, args2);
         // }
 
-        void deleteNode(MapNodePtr ptr) { delete ptr; }
+        void deleteNode(MapNodePtr ptr)
+        {
+            NodeTraits::destroy(_allocator, ptr);
+            NodeTraits::deallocate(_allocator, ptr, 1);
+        }
     };
 
-    template <class K, class T> bool operator==(const Map<K, T> &lhs, const Map<K, T> &rhs)
+    template <class K, class T, class A> bool operator==(const Map<K, T, A> &lhs, const Map<K, T, A> &rhs)
     {
         return std::equal(lhs.begin(), lhs.end(), rhs.begin(), rhs.end());
     }
 
-    template <class K, class T> bool operator!=(const Map<K, T> &lhs, const Map<K, T> &rhs) { return !(lhs == rhs); }
+    template <class K, class T, class A> bool operator!=(const Map<K, T, A> &lhs, const Map<K, T, A> &rhs)
+    {
+        return !(lhs == rhs);
+    }
 
-    template <class K, class T> bool operator<(const Map<K, T> &lhs, const Map<K, T> &rhs)
+    template <class K, class T, class A> bool operator<(const Map<K, T, A> &lhs, const Map<K, T, A> &rhs)
     {
         return std::lexicographical_compare(lhs.begin(), lhs.end(), rhs.begin(), rhs.end());
     }
 
-    template <class K, class T> bool operator<=(const Map<K, T> &lhs, const Map<K, T> &rhs)
+    template <class K, class T, class A> bool operator<=(const Map<K, T, A> &lhs, const Map<K, T, A> &rhs)
     {
         return lhs < rhs || lhs == rhs;
     }
 
-    template <class K, class T> bool operator>(const Map<K, T> &lhs, const Map<K, T> &rhs)
+    template <class K, class T, class A> bool operator>(const Map<K, T, A> &lhs, const Map<K, T, A> &rhs)
     {
         return std::lexicographical_compare(rhs.begin(), rhs.end(), lhs.begin(), lhs.end());
     }
 
-    template <class K, class T> bool operator>=(const Map<K, T> &lhs, const Map<K, T> &rhs)
+    template <class K, class T, class A> bool operator>=(const Map<K, T, A> &lhs, const Map<K, T, A> &rhs)
     {
         return lhs > rhs || lhs == rhs;
     }
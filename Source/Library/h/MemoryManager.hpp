@@ -1,25 +1,498 @@
 #pragma once
 
 #include <algorithm>
+#include <array>
+#include <atomic>
+#include <bit>
+#include <chrono>
+#include <condition_variable>
 #include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <deque>
+#include <functional>
+#include <iosfwd>
+#include <map>
 #include <memory>
+#include <mutex>
+#include <new>
+#include <string>
+#include <type_traits>
+#include <typeinfo>
 #include <unordered_map>
+#include <unordered_set>
+#include <vector>
 
 namespace sd
 {
+    /**
+     * Managed objects of pointer free types are never scanned for pointers to other managed objects,
+     * specialize it for own types which do not hold pointers to managed objects or create them with sd::makeAtomic
+     */
+    template <class T> struct IsPointerFree : std::is_arithmetic<std::remove_all_extents_t<T>>
+    {
+    };
+    template <class T, size_t N> struct IsPointerFree<std::array<T, N>> : IsPointerFree<T>
+    {
+    };
+
+    /**
+     * Unreachable managed objects of finalizable types are not destroyed by sweep, they are handed over to
+     * finalization queue drained by sd::MemoryManager::runFinalizers or finalizer thread, specialize it for own types
+     * with expensive destructors, for example closing files or flushing buffers
+     */
+    template <class T> struct IsFinalizable : std::false_type
+    {
+    };
+
     class MemoryManager
     {
+      public:
+        /**
+         * Histogram of pause durations with logarithmic buckets, percentiles are accurate to ~25%
+         */
+        class PauseHistogram
+        {
+          private:
+            std::array<uint64_t, 256> _buckets = {};
+            uint64_t _count = 0;
+            std::chrono::nanoseconds _max{0};
+
+            static size_t bucketOf(uint64_t ns)
+            {
+                if (ns < 4)
+                {
+                    return ns;
+                }
+                auto exponent = std::bit_width(ns) - 1;
+                return exponent * 4 + ((ns >> (exponent - 2)) & 3);
+            }
+            static uint64_t bucketUpperBound(size_t bucket)
+            {
+                if (bucket < 4)
+                {
+                    return bucket;
+                }
+                return ((4 + bucket % 4 + 1) << (bucket / 4 - 2)) - 1;
+            }
+
+          public:
+            void record(std::chrono::nanoseconds pause)
+            {
+                _buckets[bucketOf(std::max<int64_t>(pause.count(), 0))]++;
+                _count++;
+                _max = std::max(_max, pause);
+            }
+
+            /**
+             * Get pause duration not exceeded by given fraction of pauses, for example percentile(0.99)
+             */
+            std::chrono::nanoseconds percentile(double fraction) const
+            {
+                auto target = static_cast<uint64_t>(fraction * _count);
+                uint64_t seen = 0;
+                for (size_t i = 0; i < _buckets.size(); i++)
+                {
+                    seen += _buckets[i];
+                    if (seen > target || (seen == _count && seen))
+                    {
+                        return std::min(std::chrono::nanoseconds(bucketUpperBound(i)), _max);
+                    }
+                }
+                return std::chrono::nanoseconds{0};
+            }
+
+            uint64_t count() const { return _count; }
+            std::chrono::nanoseconds max() const { return _max; }
+        };
+
+        /**
+         * Statistics of single collection, for incremental collections times are summed over all slices
+         */
+        struct CollectionStats
+        {
+            bool minor = false;
+            size_t freedBytes = 0;
+            size_t freedObjects = 0;
+            size_t survivedBytes = 0;
+            size_t survivedObjects = 0;
+            size_t movedBytes = 0;
+            size_t movedObjects = 0;
+            std::chrono::nanoseconds markTime{0};
+            std::chrono::nanoseconds sweepTime{0};
+            std::chrono::nanoseconds pause{0};
+            // ambiguous root words found, values in scanned stacks and ranges equal to address of some object, the
+            // same object may be counted many times and may be reachable from explicit roots too
+            size_t ambiguousRoots = 0;
+            // heap pages hit by scanned values not pointing at any object, see setBlacklistingMode
+            size_t blacklistedPages = 0;
+
+            double survivalRate() const
+            {
+                auto total = survivedBytes + freedBytes;
+                return total ? static_cast<double>(survivedBytes) / total : 1.0;
+            }
+        };
+
+        /**
+         * Decides memory limit which triggers next collection, consulted after each full collection
+         */
+        struct IPacingPolicy
+        {
+            virtual size_t getMemoryLimit(size_t liveBytes, size_t currentLimit) = 0;
+
+            virtual ~IPacingPolicy() {}
+        };
+
+        /**
+         * Sets limit to live bytes after collection multiplied by growth factor, clamped to min and max limit.
+         * Limit grows immediately, but shrinks only after it was too big for shrinkAfter consecutive collections,
+         * shrinkAfter = 0 disables shrinking
+         */
+        class GrowthFactorPacingPolicy : public IPacingPolicy
+        {
+          private:
+            double _growthFactor;
+            size_t _minLimit;
+            size_t _maxLimit;
+            size_t _shrinkAfter;
+            size_t _lowUsageCollections = 0;
+
+          public:
+            GrowthFactorPacingPolicy(double growthFactor = 2.0, size_t minLimit = 1 * 1024 * 1024,
+                                     size_t maxLimit = SIZE_MAX, size_t shrinkAfter = 0)
+                : _growthFactor(growthFactor), _minLimit(minLimit), _maxLimit(maxLimit), _shrinkAfter(shrinkAfter)
+            {
+            }
+
+            size_t getMemoryLimit(size_t liveBytes, size_t currentLimit) override
+            {
+                auto target = std::clamp(static_cast<size_t>(liveBytes * _growthFactor), _minLimit, _maxLimit);
+                if (target >= currentLimit)
+                {
+                    _lowUsageCollections = 0;
+                    return target;
+                }
+                if (!_shrinkAfter || ++_lowUsageCollections < _shrinkAfter)
+                {
+                    return currentLimit;
+                }
+                _lowUsageCollections = 0;
+                return target;
+            }
+        };
+
+        /**
+         * Cumulative statistics of memory manager
+         */
+        struct Stats
+        {
+            size_t collections = 0;
+            size_t minorCollections = 0;
+            size_t incrementalSlices = 0;
+            size_t markStackOverflows = 0;
+            size_t memoryPressureTriggers = 0;
+            size_t freedBytes = 0;
+            size_t freedObjects = 0;
+            size_t movedBytes = 0;
+            std::chrono::nanoseconds totalMarkTime{0};
+            std::chrono::nanoseconds totalSweepTime{0};
+            std::chrono::nanoseconds totalPause{0};
+            PauseHistogram pauses;
+            CollectionStats lastCollection;
+        };
+
+        /**
+         * Allocations sampled with the same type and call stack, estimated bytes scale samples by sample interval
+         */
+        struct AllocationSite
+        {
+            std::string type;
+            std::vector<std::string> frames; // innermost first, includes frames of memory manager
+            size_t samples = 0;
+            size_t sampledBytes = 0;
+            size_t estimatedBytes = 0;
+            size_t liveSamples = 0; // sampled objects not collected yet
+            size_t liveBytes = 0;
+
+            double survivalRate() const { return sampledBytes ? static_cast<double>(liveBytes) / sampledBytes : 0.0; }
+        };
+
+        /**
+         * Live objects grouped by type with references between types, taken after full collection
+         */
+        struct HeapSnapshot
+        {
+            struct TypeStats
+            {
+                std::string name;
+                size_t count = 0;
+                size_t bytes = 0;
+                size_t rootReferences = 0; // objects of this type referenced directly from roots
+            };
+
+            /**
+             * Number of pointers from objects of type at index from to objects of type at index to
+             */
+            struct Reference
+            {
+                size_t from = 0;
+                size_t to = 0;
+                size_t count = 0;
+            };
+
+            size_t objects = 0;
+            size_t bytes = 0;
+            std::vector<TypeStats> types; // sorted by bytes, biggest first
+            std::vector<Reference> references;
+
+            void writeJson(std::ostream &out) const;
+
+            /**
+             * Writes compact dump in host byte order: "SDHS", u32 version, u64 objects, u64 bytes, u32 types count,
+             * types as (u32 name length, name, u64 count, u64 bytes, u64 root references), u32 references count,
+             * references as (u32 from, u32 to, u64 count)
+             */
+            void writeBinary(std::ostream &out) const;
+        };
+
+        /**
+         * Node of intrusive list of explicit roots, object pointed by slot is kept alive by every collection
+         */
+        struct RootNode
+        {
+            void **slot = nullptr;
+            MemoryManager *manager = nullptr;
+            RootNode *prev = nullptr;
+            RootNode *next = nullptr;
+        };
+
+        /**
+         * Node of intrusive list of additional memory ranges scanned conservatively like stacks, for example stacks of
+         * fibers or coroutine frames. Bounds may be changed while range is registered, so scheduler can narrow stack of
+         * suspended fiber to its saved stack pointer without touching the list
+         */
+        struct ScanRange
+        {
+            void *begin = nullptr;
+            void *end = nullptr;
+            MemoryManager *manager = nullptr;
+            ScanRange *prev = nullptr;
+            ScanRange *next = nullptr;
+        };
+
+        /**
+         * Slot of weak reference registered in memory manager, pointer is kept hidden from conservative scanning
+         */
+        struct WeakSlot
+        {
+            uintptr_t hiddenPtr = hidePointer(nullptr);
+            MemoryManager *manager = nullptr;
+        };
+
+        /**
+         * Table which holds its keys weakly and its values only as long as their keys are alive, see sd::GcWeakMap
+         */
+        struct IEphemeronTable
+        {
+            /**
+             * Scans values of live keys not scanned yet in given mark epoch, returns true if any value was scanned
+             */
+            virtual bool traceValues(size_t epoch, const std::function<bool(void *)> &isAlive,
+                                     const std::function<void(const void *, size_t)> &scan) = 0;
+            virtual void removeDeadEntries(const std::function<bool(void *)> &isAlive) = 0;
+            // called when memory manager is destroyed before table
+            virtual void detach() = 0;
+
+            virtual ~IEphemeronTable() {}
+        };
+
+        static uintptr_t hidePointer(const void *ptr) { return ~reinterpret_cast<uintptr_t>(ptr); }
+        static void *revealPointer(uintptr_t hiddenPtr) { return reinterpret_cast<void *>(~hiddenPtr); }
+
 #pragma region HelperClasses
       private:
+        static constexpr size_t SizeClassesCount = 28;
+        static constexpr size_t MaxCellSize = 2048;
+        static constexpr size_t DecommitDelay = 2;   // collections after which free chunk is decommitted
+        static constexpr size_t MaxFreeChunks = 16; // free chunks kept reserved for reuse
+        static constexpr size_t LargeObjectSize = 64 * 1024; // objects at least that big are mapped separately
+        static constexpr size_t PageSize = 4096;
+        static constexpr size_t MarkStackSize = 4096; // initial capacity, doubled after each overflow
+        static constexpr size_t EvacuationOccupancy = 50; // percent, less occupied chunks are evacuated by compaction
+
+        /**
+         * Aligned block of memory mapped from OS, objects are placed in it by bumping pointer or, for chunks with
+         * cell size, in cells of that size which are reused when freed. Chunk is reused or returned to OS only when all
+         * of its objects were collected
+         */
+        class Chunk
+        {
+          public:
+            static constexpr size_t Size = 256 * 1024;
+
+          private:
+            uint8_t *_begin = nullptr;
+            uint8_t *_end = nullptr;
+            uint8_t *_top = nullptr;
+            std::atomic<size_t> _objectsCount = 0;
+            std::atomic<void *> _freeCells = nullptr;
+            size_t _cellSize = 0;
+            size_t _freeCollections = 0;
+            bool _young = true;
+            bool _committed = true;
+            std::atomic<Chunk *> _next = nullptr; // link in stack of chunks waiting to become allocation buffers
+            std::atomic<uint64_t> _blacklist = 0; // pages hit by false pointers, objects do not start on them
+
+          public:
+            explicit Chunk(size_t minSize = Size);
+            Chunk(const Chunk &) = delete;
+            Chunk &operator=(const Chunk &) = delete;
+            ~Chunk();
+
+            void *allocate(size_t size, size_t alignment)
+            {
+                if (_cellSize)
+                {
+                    return allocateCell();
+                }
+                auto address = (reinterpret_cast<uintptr_t>(_top) + alignment - 1) & ~(alignment - 1);
+                auto ptr = reinterpret_cast<uint8_t *>(address);
+                while (ptr < _end && isBlacklisted(ptr))
+                {
+                    auto nextPage = (reinterpret_cast<uintptr_t>(ptr) & ~(PageSize - 1)) + PageSize;
+                    ptr = reinterpret_cast<uint8_t *>((nextPage + alignment - 1) & ~(alignment - 1));
+                }
+                if (ptr + size > _end)
+                {
+                    return nullptr;
+                }
+                _top = ptr + size;
+                return ptr;
+            }
+
+            void retain() { _objectsCount++; }
+            // may be called by sweeper thread, only owner thread takes cells from free list
+            void release(void *objectPtr)
+            {
+                if (_cellSize)
+                {
+                    auto head = _freeCells.load();
+                    do
+                    {
+                        *static_cast<void **>(objectPtr) = head;
+                    } while (!_freeCells.compare_exchange_weak(head, objectPtr));
+                }
+                _objectsCount--;
+            }
+            bool empty() const { return _objectsCount == 0; }
+            size_t getObjectsCount() const { return _objectsCount; }
+            bool hasFreeCells() const { return _freeCells || _top + _cellSize <= _end; }
+            size_t getCellSize() const { return _cellSize; }
+
+            /**
+             * Marks page holding given address, objects are not allocated at blacklisted pages until next root scan,
+             * so value which only looks like pointer will not retain object allocated there later
+             */
+            void blacklist(const void *ptr)
+            {
+                auto page = (static_cast<const uint8_t *>(ptr) - _begin) / PageSize;
+                if (page < 64)
+                {
+                    _blacklist.fetch_or(uint64_t{1} << page, std::memory_order_relaxed);
+                }
+            }
+            bool isBlacklisted(const void *ptr) const
+            {
+                auto blacklist = _blacklist.load(std::memory_order_relaxed);
+                auto page = (static_cast<const uint8_t *>(ptr) - _begin) / PageSize;
+                return blacklist && page < 64 && (blacklist >> page) & 1;
+            }
+            size_t getBlacklistedPages() const { return std::popcount(_blacklist.load(std::memory_order_relaxed)); }
+            void clearBlacklist() { _blacklist.store(0, std::memory_order_relaxed); }
+
+            bool isYoung() const { return _young; }
+            void promote() { _young = false; }
+            Chunk *getNext() const { return _next.load(std::memory_order_relaxed); }
+            void setNext(Chunk *next) { _next.store(next, std::memory_order_relaxed); }
+            void reset(size_t cellSize = 0)
+            {
+                _top = _begin;
+                // cells may hold objects of both generations, write barrier checks youth of their holders
+                _young = !cellSize;
+                _cellSize = cellSize;
+                _freeCells = nullptr;
+                _freeCollections = 0;
+                clearBlacklist();
+            }
+
+            /**
+             * Counts collections after which chunk stayed free, returns updated count
+             */
+            size_t ageFree() { return ++_freeCollections; }
+            bool isCommitted() const { return _committed; }
+            void commit();
+            void decommit();
+
+            uint8_t *begin() const { return _begin; }
+            uint8_t *end() const { return _end; }
+            size_t size() const { return _end - _begin; }
+
+          private:
+            void *allocateCell()
+            {
+                auto cell = _freeCells.load();
+                while (cell)
+                {
+                    if (!_freeCells.compare_exchange_weak(cell, *static_cast<void **>(cell)))
+                    {
+                        continue;
+                    }
+                    if (!isBlacklisted(cell))
+                    {
+                        return cell;
+                    }
+                    // cell on blacklisted page is dropped, it is reused when whole chunk becomes free
+                    cell = _freeCells.load();
+                }
+                while (_top + _cellSize <= _end && isBlacklisted(_top))
+                {
+                    _top += _cellSize;
+                }
+                if (_top + _cellSize > _end)
+                {
+                    return nullptr;
+                }
+                auto ptr = _top;
+                _top += _cellSize;
+                return ptr;
+            }
+        };
+
         struct IObjectHolder
         {
             virtual void *getObjectPtr() const = 0;
 
             virtual size_t getObjectSize() const = 0;
+            virtual const std::type_info &getType() const = 0;
+            // distance between addresses checked when object is scanned for pointers
+            virtual size_t getScanStep() const = 0;
 
             virtual bool isMarked() const = 0;
             virtual void mark() = 0;
             virtual void unmark() = 0;
+            virtual bool tryMark() = 0;
+
+            virtual bool isYoung() const = 0;
+            virtual void promote() = 0;
+            virtual Chunk *getChunk() const = 0;
+            virtual bool isLarge() const = 0;
+            virtual bool isPointerFree() const = 0;
+            virtual bool isFinalizable() const = 0;
+            // object can be moved to other cell of the same size class by compaction
+            virtual bool isMovable() const = 0;
+            // returns false when chunk has no cell left for object
+            virtual bool moveTo(Chunk &chunk) = 0;
 
             virtual void destroyObject() = 0;
             virtual bool isValid() const = 0;
@@ -27,38 +500,315 @@ namespace sd
             virtual ~IObjectHolder() {}
         };
 
-        template <class T> class ObjectHolder final : public IObjectHolder
+        /**
+         * Collector state kept by holders of single objects and arrays
+         */
+        class HolderBase : public IObjectHolder
+        {
+          protected:
+            std::atomic<bool> _marked = false;
+            bool _young = true;
+            bool _large = false;
+            bool _pointerFree = false;
+            bool _finalizable = false;
+            Chunk *_chunk = nullptr;
+
+            HolderBase(Chunk *chunk, bool pointerFree, bool finalizable)
+                : _pointerFree(pointerFree), _finalizable(finalizable), _chunk(chunk)
+            {
+            }
+
+          public:
+            HolderBase(const HolderBase &) = delete;
+            HolderBase &operator=(const HolderBase &) = delete;
+
+            bool isMarked() const final { return _marked.load(std::memory_order_relaxed); }
+            void mark() final { _marked.store(true, std::memory_order_relaxed); }
+            void unmark() final { _marked.store(false, std::memory_order_relaxed); }
+            // returns true if object was marked by this call, safe to use from many marking threads
+            bool tryMark() final { return !isMarked() && !_marked.exchange(true, std::memory_order_relaxed); }
+
+            bool isYoung() const final { return _young; }
+            void promote() final { _young = false; }
+            Chunk *getChunk() const final { return _chunk; }
+            bool isLarge() const final { return _large; }
+            bool isPointerFree() const final { return _pointerFree; }
+            bool isFinalizable() const final { return _finalizable; }
+            void setPointerFree() { _pointerFree = true; }
+        };
+
+        template <class T> class ObjectHolder final : public HolderBase
         {
           private:
-            bool _marked = false;
-            std::unique_ptr<T> _objectPtr;
+            T *_objectPtr = nullptr;
 
-            ObjectHolder(T *objectPtr) : _objectPtr(objectPtr) {}
+            ObjectHolder(T *objectPtr, Chunk *chunk)
+                : HolderBase(chunk, IsPointerFree<T>::value, IsFinalizable<T>::value), _objectPtr(objectPtr)
+            {
+            }
 
           public:
-            ObjectHolder(const ObjectHolder &) = delete;
-            ObjectHolder &operator=(const ObjectHolder &) = delete;
+            static constexpr bool IsArray = false;
+
+            ~ObjectHolder() { destroyObject(); }
 
             template <class... Args> static std::unique_ptr<ObjectHolder<T>> create(Args &&...params)
             {
                 auto objectPtr = new T{std::forward<Args>(params)...};
-                return std::unique_ptr<ObjectHolder<T>>(new ObjectHolder{objectPtr});
+                return std::unique_ptr<ObjectHolder<T>>(new ObjectHolder{objectPtr, nullptr});
             };
 
-            T *getTypedObjectPtr() const { return _objectPtr.get(); }
-            void *getObjectPtr() const final { return _objectPtr.get(); }
+            /**
+             * Creates object in memory allocated from chunk, returns nullptr if chunk has not enough space
+             */
+            template <class... Args> static std::unique_ptr<ObjectHolder<T>> createIn(Chunk &chunk, Args &&...params)
+            {
+                auto memory = chunk.allocate(sizeof(T), alignof(T));
+                if (!memory)
+                {
+                    return nullptr;
+                }
+                auto objectPtr = new (memory) T{std::forward<Args>(params)...};
+                chunk.retain();
+                return std::unique_ptr<ObjectHolder<T>>(new ObjectHolder{objectPtr, &chunk});
+            };
+
+            /**
+             * Creates object in memory mapped only for it, memory is unmapped when object is destroyed
+             */
+            template <class... Args> static std::unique_ptr<ObjectHolder<T>> createLarge(Args &&...params)
+            {
+                auto memory = mapLargeObject(sizeof(T));
+                try
+                {
+                    auto objectPtr = new (memory) T{std::forward<Args>(params)...};
+                    auto objectHolder = std::unique_ptr<ObjectHolder<T>>(new ObjectHolder{objectPtr, nullptr});
+                    objectHolder->_large = true;
+                    return objectHolder;
+                }
+                catch (...)
+                {
+                    unmapLargeObject(memory, sizeof(T));
+                    throw;
+                }
+            };
+
+            T *getTypedObjectPtr() const { return _objectPtr; }
+            void *getObjectPtr() const final { return _objectPtr; }
 
             size_t getObjectSize() const final { return sizeof(T); }
+            const std::type_info &getType() const final { return typeid(T); }
+            size_t getScanStep() const final { return 1; }
 
-            bool isMarked() const final { return _marked; }
-            void mark() final { _marked = true; }
-            void unmark() final { _marked = false; }
+            bool isMovable() const final { return _chunk && std::is_nothrow_move_constructible_v<T>; }
+            bool moveTo(Chunk &chunk) final
+            {
+                if constexpr (std::is_nothrow_move_constructible_v<T>)
+                {
+                    auto memory = chunk.allocate(sizeof(T), alignof(T));
+                    if (!memory)
+                    {
+                        return false;
+                    }
+                    auto objectPtr = new (memory) T(std::move(*_objectPtr));
+                    chunk.retain();
+                    _objectPtr->~T();
+                    _chunk->release(_objectPtr);
+                    _objectPtr = objectPtr;
+                    _chunk = &chunk;
+                }
+                return true;
+            }
 
-            void destroyObject() { _objectPtr.reset(); }
+            void destroyObject()
+            {
+                if (!_objectPtr)
+                {
+                    return;
+                }
+                if (_chunk)
+                {
+                    _objectPtr->~T();
+                    _chunk->release(_objectPtr);
+                }
+                else if (_large)
+                {
+                    _objectPtr->~T();
+                    unmapLargeObject(_objectPtr, sizeof(T));
+                }
+                else
+                {
+                    delete _objectPtr;
+                }
+                _objectPtr = nullptr;
+            }
             bool isValid() const final { return !!getObjectPtr(); }
             operator bool() const { return isValid(); }
         };
 
+        /**
+         * Holder of value initialized elements placed one after another, array is identified by its first element.
+         * Elements aligned like pointers are scanned only at pointer aligned addresses
+         */
+        template <class T> class ArrayHolder final : public HolderBase
+        {
+          private:
+            T *_elementsPtr = nullptr;
+            size_t _length = 0;
+
+            ArrayHolder(T *elementsPtr, size_t length, Chunk *chunk)
+                : HolderBase(chunk, IsPointerFree<T>::value, IsFinalizable<T>::value), _elementsPtr(elementsPtr),
+                  _length(length)
+            {
+            }
+
+            static T *constructElements(void *memory, size_t length)
+            {
+                auto elementsPtr = static_cast<T *>(memory);
+                size_t constructed = 0;
+                try
+                {
+                    for (; constructed < length; constructed++)
+                    {
+                        new (elementsPtr + constructed) T();
+                    }
+                }
+                catch (...)
+                {
+                    std::destroy_n(elementsPtr, constructed);
+                    throw;
+                }
+                return elementsPtr;
+            }
+
+          public:
+            // length of array is looked up in objects register, so array is registered as soon as it is created
+            static constexpr bool IsArray = true;
+
+            ~ArrayHolder() { destroyObject(); }
+
+            /**
+             * Get number of bytes needed for array, empty arrays take place of one element to get unique address
+             */
+            static size_t getAllocationSize(size_t length)
+            {
+                if (length > SIZE_MAX / sizeof(T))
+                {
+                    throw std::bad_array_new_length{};
+                }
+                return std::max<size_t>(length, 1) * sizeof(T);
+            }
+
+            static std::unique_ptr<ArrayHolder<T>> create(size_t length)
+            {
+                auto memory = ::operator new(getAllocationSize(length), std::align_val_t{alignof(T)});
+                try
+                {
+                    auto elementsPtr = constructElements(memory, length);
+                    return std::unique_ptr<ArrayHolder<T>>(new ArrayHolder{elementsPtr, length, nullptr});
+                }
+                catch (...)
+                {
+                    ::operator delete(memory, std::align_val_t{alignof(T)});
+                    throw;
+                }
+            }
+
+            /**
+             * Creates array in memory allocated from chunk, returns nullptr if chunk has not enough space
+             */
+            static std::unique_ptr<ArrayHolder<T>> createIn(Chunk &chunk, size_t length)
+            {
+                auto memory = chunk.allocate(getAllocationSize(length), alignof(T));
+                if (!memory)
+                {
+                    return nullptr;
+                }
+                chunk.retain();
+                try
+                {
+                    auto elementsPtr = constructElements(memory, length);
+                    return std::unique_ptr<ArrayHolder<T>>(new ArrayHolder{elementsPtr, length, &chunk});
+                }
+                catch (...)
+                {
+                    chunk.release(memory);
+                    throw;
+                }
+            }
+
+            /**
+             * Creates array in memory mapped only for it, memory is unmapped when array is destroyed
+             */
+            static std::unique_ptr<ArrayHolder<T>> createLarge(size_t length)
+            {
+                auto memory = mapLargeObject(getAllocationSize(length));
+                try
+                {
+                    auto elementsPtr = constructElements(memory, length);
+                    auto arrayHolder = std::unique_ptr<ArrayHolder<T>>(new ArrayHolder{elementsPtr, length, nullptr});
+                    arrayHolder->_large = true;
+                    return arrayHolder;
+                }
+                catch (...)
+                {
+                    unmapLargeObject(memory, getAllocationSize(length));
+                    throw;
+                }
+            }
+
+            T *getTypedObjectPtr() const { return _elementsPtr; }
+            void *getObjectPtr() const final { return _elementsPtr; }
+            size_t getLength() const { return _length; }
+
+            size_t getObjectSize() const final { return _length * sizeof(T); }
+            const std::type_info &getType() const final { return typeid(T[]); }
+            size_t getScanStep() const final { return alignof(T) % alignof(void *) == 0 ? sizeof(void *) : 1; }
+
+            bool isMovable() const final { return _chunk && std::is_nothrow_move_constructible_v<T>; }
+            bool moveTo(Chunk &chunk) final
+            {
+                if constexpr (std::is_nothrow_move_constructible_v<T>)
+                {
+                    auto elementsPtr = static_cast<T *>(chunk.allocate(getAllocationSize(_length), alignof(T)));
+                    if (!elementsPtr)
+                    {
+                        return false;
+                    }
+                    std::uninitialized_move_n(_elementsPtr, _length, elementsPtr);
+                    chunk.retain();
+                    std::destroy_n(_elementsPtr, _length);
+                    _chunk->release(_elementsPtr);
+                    _elementsPtr = elementsPtr;
+                    _chunk = &chunk;
+                }
+                return true;
+            }
+
+            void destroyObject()
+            {
+                if (!_elementsPtr)
+                {
+                    return;
+                }
+                std::destroy_n(_elementsPtr, _length);
+                if (_chunk)
+                {
+                    _chunk->release(_elementsPtr);
+                }
+                else if (_large)
+                {
+                    unmapLargeObject(_elementsPtr, getAllocationSize(_length));
+                }
+                else
+                {
+                    ::operator delete(_elementsPtr, std::align_val_t{alignof(T)});
+                }
+                _elementsPtr = nullptr;
+            }
+            bool isValid() const final { return !!getObjectPtr(); }
+        };
+
         class ObjectsRegister
         {
           private:
@@ -70,7 +820,11 @@ namespace sd
                 _objectsMap.insert({objectHolder->getObjectPtr(), std::move(objectHolder)});
             }
             bool isObjectRegistered(void *objectPtr) const { return _objectsMap.contains(objectPtr); }
-            IObjectHolder &getObjectHolder(void *objectPtr) { return *_objectsMap.at(objectPtr); }
+            IObjectHolder &getObjectHolder(void *objectPtr) const { return *_objectsMap.at(objectPtr); }
+            std::unique_ptr<IObjectHolder> releaseObject(void *objectPtr)
+            {
+                return std::move(_objectsMap.extract(objectPtr).mapped());
+            }
 
             void clear() { _objectsMap.clear(); }
 
@@ -86,14 +840,132 @@ namespace sd
                 std::for_each(_objectsMap.begin(), _objectsMap.end(), [&](auto &pair) { func(*pair.second); });
             }
         };
+        class BackgroundSweeper;
+        class MarkHelpers;
+
+        /**
+         * Thread registered in shared heap, stack pointer is set while thread is parked or in safe region
+         */
+        struct ThreadRecord
+        {
+            uint8_t *stackTop = nullptr;
+            uint8_t *stackPointer = nullptr;
+            size_t safeRegionDepth = 0;
+
+            // thread local allocation buffer, objects are bump allocated in chunk owned by thread and registered in
+            // shared heap in batches
+            Chunk *tlab = nullptr;
+            std::vector<std::unique_ptr<IObjectHolder>> pendingObjects;
+            size_t pendingBytes = 0;
+            // part of pendingBytes not yet added to shared counter which triggers collections
+            size_t unreportedBytes = 0;
+            // stacks of sampled allocations are captured at allocation site, samples are recorded by flush
+            size_t bytesUntilSample = 0;
+            std::vector<std::pair<IObjectHolder *, std::vector<void *>>> pendingSamples;
+        };
 #pragma endregion
       private:
         ObjectsRegister _objectsRegister;
 
         size_t _allocatedMemory = 0;
         size_t _memoryLimit = 1 * 1024 * 1024; // ~1MB
+        double _pressureThreshold = 0;
+        size_t _processMemoryLimit = 0;
+        size_t _bytesUntilPressureCheck = 0;
+        bool _memoryPressure = false;
+        bool _pressureCollectionNeeded = false;
+        size_t _lastProcessMemory = 0;
+        size_t _lastProcessLimit = 0;
+        std::string _cgroupPath;
+        // memory.max is read when trigger is enabled, usage file stays open and is reread from start
+        size_t _cgroupLimit = 0;
+        int _pressureFile = -1;
+        std::chrono::steady_clock::time_point _nextPressureCheck;
+
+        bool _generational = false;
+        bool _compaction = false;
+        size_t _scopeDepth = 0;
+        size_t _tenuredConstructions = 0;
+        size_t _youngMemory = 0;
+        size_t _nurserySize = 256 * 1024; // ~256KB
+        Chunk *_nurseryChunk = nullptr;
+        std::vector<std::unique_ptr<Chunk>> _chunks;
+        std::vector<std::unique_ptr<Chunk>> _freeChunks;
+        std::unordered_map<uintptr_t, Chunk *> _chunksIndex;
+        std::array<Chunk *, SizeClassesCount> _cellChunks = {};
+        std::array<std::vector<Chunk *>, SizeClassesCount> _partialChunks;
+        bool _chunksReclaimNeeded = false;
+        size_t _reservedMemory = 0;
+        size_t _residentMemory = 0;
+        std::map<uintptr_t, IObjectHolder *> _largeObjects;
+        std::vector<IObjectHolder *> _youngObjects;
+        std::unordered_set<void **> _rememberedSet;
+        std::unordered_set<void *> _untrackedObjects;
+
+        bool _incremental = false;
+        bool _marking = false;
+        // full collection requested on stack which could not be scanned, runs on next allocation from known stack
+        bool _collectionPending = false;
+        std::chrono::microseconds _markSliceBudget{200};
+        size_t _markCredit = 0; // bytes allocated while marking which were not paid by slices yet
+        Stats _stats;
+        CollectionStats _currentCollection;
+        std::function<void(const CollectionStats &)> _collectionCallback;
+        std::unique_ptr<IPacingPolicy> _pacingPolicy;
+        std::vector<void *> _markStack;
+        size_t _markStackCapacity = MarkStackSize;
+        bool _markStackOverflow = false;
+        size_t _markThreads = 1;
+        std::unique_ptr<MarkHelpers> _markHelpers;
+
+        bool _lazySweep = false;
+        std::vector<void *> _sweepList;
+        std::unique_ptr<BackgroundSweeper> _sweeper;
+        std::unique_ptr<BackgroundSweeper> _finalizerThread;
+        std::mutex _finalizersMutex;
+        std::deque<std::unique_ptr<IObjectHolder>> _finalizationQueue;
+
+        bool _shared = false;
+        mutable std::mutex _heapMutex;
+        std::mutex _worldMutex;
+        std::condition_variable _worldChanged;
+        std::atomic<bool> _stopRequested = false;
+        size_t _parkedThreads = 0;
+        std::vector<ThreadRecord *> _threads;
+        std::atomic<Chunk *> _tlabChunks = nullptr;
+        // bytes waiting in allocation buffers and room left until memory limit, allocation fast path compares them
+        // without taking heap lock
+        std::atomic<size_t> _tlabBytes = 0;
+        std::atomic<size_t> _tlabRoom = 0;
+
+        RootNode *_roots = nullptr;
+        ScanRange *_scanRanges = nullptr;
+        // roots, weak slots and tables may be unregistered by destructors running on sweeper or finalizer thread, also
+        // by ones run while owner holds the lock
+        std::recursive_mutex _rootsMutex;
+        bool _preciseRoots = false;
+        bool _blacklisting = false;
+        std::unordered_set<WeakSlot *> _weakSlots;
+        std::unordered_set<IEphemeronTable *> _ephemeronTables;
+        size_t _markEpoch = 0;
+
+        struct SampledSite
+        {
+            const std::type_info *type = nullptr;
+            std::vector<void *> frames;
+            size_t samples = 0;
+            size_t sampledBytes = 0;
+            size_t estimatedBytes = 0;
+            size_t liveSamples = 0;
+            size_t liveBytes = 0;
+        };
+        size_t _sampleInterval = 0;
+        size_t _bytesUntilSample = 0;
+        std::vector<SampledSite> _sampledSites;
+        std::unordered_map<void *, size_t> _sampledObjects; // sampled live object to index of its site
 
         MemoryManager() = default;
+        explicit MemoryManager(bool shared);
 
       public:
         ~MemoryManager();
@@ -101,29 +973,91 @@ namespace sd
         MemoryManager &operator=(const MemoryManager &) = delete;
 
         /**
-         * Get Memory Manager singeleton instance, note that each thread has its own memory manager
+         * Get Memory Manager singeleton instance, note that each thread has its own memory manager,
+         * threads registered in shared heap get shared memory manager
          */
         static MemoryManager &instance();
 
+        /**
+         * Get process wide memory manager used by registered threads, objects allocated in it can be passed between
+         * them. Collections stop all registered threads at safepoints, shared heap supports only stop the world
+         * collections, so generational, incremental and lazy sweep modes are not used by it. Registered threads
+         * allocate small objects from own allocation buffers without locking, they are registered by collections
+         * at safepoints, so objects count may lag behind until next collection
+         */
+        static MemoryManager &shared();
+
+        /**
+         * Registers calling thread in shared heap, its stack is scanned by shared heap collections and sd::make
+         * allocates from shared heap. Registered thread has to reach safepoints regularly (every sd::make is one,
+         * sd::gcSafepoint can be called in long computations) or enter safe region before blocking
+         */
+        static void registerThread();
+        static void unregisterThread();
+
+        /**
+         * Parks calling registered thread if collection of shared heap is in progress
+         */
+        static void safepoint();
+
+        /**
+         * Safe region lets registered thread block (join, wait, io) without stopping shared heap collections,
+         * thread must not touch managed objects until it leaves safe region
+         */
+        static void enterSafeRegion();
+        static void leaveSafeRegion();
+
         /**
          * Get Pointner to newly created menagable object,
          * if object wont be recheable in stack scope it will be collected
          */
         template <class T, class... Args> T *createObject(Args &&...params)
         {
-            std::unique_ptr<ObjectHolder<T>> objectHolderPtr = ObjectHolder<T>::create(std::forward<Args>(params)...);
-            T *ptr = objectHolderPtr->getTypedObjectPtr();
-            _allocatedMemory += objectHolderPtr->getObjectSize();
-            _objectsRegister.registerObject(std::move(objectHolderPtr));
-            if (isGBCollectionNeeded())
-            {
-                garbageCollect();
-            }
-            if (isGBCollectionNeeded())
+            return allocateObject<ObjectHolder<T>>(false, false, sizeof(T), alignof(T), std::forward<Args>(params)...);
+        }
+
+        /**
+         * Get pointer to newly created managed object which is never scanned for pointers to other managed objects,
+         * use it for buffers of plain data, objects referenced only from it will be collected
+         */
+        template <class T, class... Args> T *createAtomicObject(Args &&...params)
+        {
+            return allocateObject<ObjectHolder<T>>(true, false, sizeof(T), alignof(T), std::forward<Args>(params)...);
+        }
+
+        /**
+         * Get pointer to newly created managed object placed directly in old generation, even in generational mode or
+         * inside sd::GcScope. Minor collections neither trace nor free it, so it may be linked to other such objects by
+         * raw pointers which bypass write barrier, nodes of sd::GcAllocator are created this way
+         */
+        template <class T, class... Args> T *createTenuredObject(Args &&...params)
+        {
+            return allocateObject<ObjectHolder<T>>(false, true, sizeof(T), alignof(T), std::forward<Args>(params)...);
+        }
+
+        /**
+         * Get pointer to first element of newly created managed array of value initialized elements, whole array is
+         * one managed object kept alive by pointer to its first element
+         */
+        template <class T> T *createArray(size_t length)
+        {
+            return allocateObject<ArrayHolder<T>>(false, false, ArrayHolder<T>::getAllocationSize(length), alignof(T),
+                                                  length);
+        }
+
+        /**
+         * Get number of elements of managed array, array has to be pointer to first element returned by createArray
+         */
+        template <class T> size_t getArrayLength(const T *array) const
+        {
+            // register of shared heap is changed by other threads
+            std::unique_lock lock{_heapMutex, std::defer_lock};
+            if (_shared)
             {
-                bumpMemoryLimit();
+                lock.lock();
             }
-            return ptr;
+            auto &arrayHolder = _objectsRegister.getObjectHolder(const_cast<T *>(array));
+            return arrayHolder.getObjectSize() / sizeof(T);
         }
 
         /**
@@ -132,23 +1066,621 @@ namespace sd
         size_t garbageCollect();
 
         /**
-         * Get number of bytes currently allocated by memory manager.
+         * Runs manually collection of young generation only, returns bytes freed during this collection,
+         * objects that survive are promoted to old generation
          */
-        size_t getAllocatedMemory() const;
+        size_t minorGarbageCollect();
 
-      private:
-        void destroyObject(IObjectHolder &objectHolder);
+        /**
+         * Runs full collection and reports remaining live objects grouped by type, costs nothing until called
+         */
+        HeapSnapshot takeHeapSnapshot();
+
+        /**
+         * Enables sampling of allocations, call stack of allocation is captured each time given number of bytes was
+         * allocated since previous sample, 0 disables sampling
+         */
+        void setAllocationSampleInterval(size_t bytes);
+        size_t getAllocationSampleInterval() const;
+
+        /**
+         * Get sampled allocations grouped by type and call stack, sorted by estimated bytes, biggest first
+         */
+        std::vector<AllocationSite> getAllocationSites() const;
+        void resetAllocationSites();
+
+        /**
+         * Get number of bytes currently allocated by memory manager.
+         */
+        size_t getAllocatedMemory() const;
+
+        /**
+         * Get number of live objects, objects found unreachable and waiting for lazy sweep are not counted
+         */
+        size_t getObjectsCount() const;
+
+        /**
+         * Get number of allocated bytes which triggers collection
+         */
+        size_t getMemoryLimit() const;
+
+        /**
+         * Set policy deciding memory limit after each full collection, by default limit starts at 1MB and is
+         * doubled when collection can not get allocated memory below it, nullptr restores default behaviour
+         */
+        void setPacingPolicy(std::unique_ptr<IPacingPolicy> policy);
+
+        /**
+         * Enables collections triggered by memory pressure, at most every MemoryPressureCheckPeriod process memory is
+         * read (cgroup v2 memory.current, or RSS when limit is set explicitly) and when it exceeds given fraction of
+         * process limit full collection is forced and memory limit is lowered to half of room left below process
+         * limit. Process limit is cgroup v2 memory.max unless set by setProcessMemoryLimit, 0 disables. Supported only
+         * on Linux, elsewhere no pressure is ever detected
+         */
+        void setMemoryPressureThreshold(double fraction);
+        double getMemoryPressureThreshold() const;
+
+        /**
+         * Set process memory limit used by memory pressure trigger instead of cgroup limit, 0 restores cgroup limit
+         */
+        void setProcessMemoryLimit(size_t bytes);
+        size_t getProcessMemoryLimit() const;
+
+        /**
+         * Check if last reading of process memory exceeded memory pressure threshold
+         */
+        bool isUnderMemoryPressure() const;
+
+        /**
+         * Get number of bytes of chunks and large objects mapped from OS, including free chunks kept for reuse
+         */
+        size_t getReservedMemory() const;
+
+        /**
+         * Get number of bytes of chunks backed by physical memory, free chunks are decommitted after few collections
+         */
+        size_t getResidentMemory() const;
+
+        /**
+         * Get number of bytes allocated since last collection (young generation)
+         */
+        size_t getYoungMemory() const;
+
+        /**
+         * Enables generational mode, new objects are bump allocated in nursery and collected by minor collections,
+         * pointers from old objects to young ones must be stored through sd::GcPtr to be seen by minor collection
+         */
+        void setGenerationalMode(bool enabled);
+        bool isGenerationalMode() const;
+
+        /**
+         * Enables mostly copying compaction, full collections evacuate objects from sparse chunks into fresh ones, so
+         * emptied chunks can be reused or returned to OS. Only objects referenced exclusively from explicit roots
+         * (sd::GcRoot) are moved and their roots and weak references are updated, chunks holding objects referenced
+         * from stacks or from other managed objects are pinned. Objects are moved by their move constructor and types
+         * which may throw from it are never moved. Pointers kept where collector does not look (precise roots mode
+         * locals, unmanaged memory) are not updated and must be read again from roots after collection
+         */
+        void setCompactionMode(bool enabled);
+        bool isCompactionMode() const;
+
+        /**
+         * Starts region used by sd::GcScope, objects created until matching leaveScope are allocated as young ones
+         * even if generational mode is disabled. Leaving outermost region runs minor collection, so objects which did
+         * not escape are freed without tracing old objects, escaped ones are promoted. Without generational mode all
+         * old objects are scanned as roots of that collection, so they may point into region by plain pointers. In
+         * generational mode such pointers must be stored through sd::GcPtr, like any pointer from old to young object.
+         * Shared heap ignores regions, returns bytes freed by leaveScope
+         */
+        void enterScope();
+        size_t leaveScope();
+
+        /**
+         * Set size of young generation, minor collection is triggered when more bytes were allocated since last one
+         */
+        void setNurserySize(size_t bytes);
+        size_t getNurserySize() const;
+
+        /**
+         * Enables incremental mode, collections triggered by allocations mark heap in slices run once enough bytes were
+         * allocated since previous one, each slice scans objects in proportion to these bytes and stops at mark slice
+         * budget. Pointers stored into managed objects must go through sd::GcPtr to be seen by ongoing marking
+         */
+        void setIncrementalMode(bool enabled);
+        bool isIncrementalMode() const;
+
+        /**
+         * Set time limit of single incremental marking slice
+         */
+        void setMarkSliceBudget(std::chrono::microseconds budget);
+        std::chrono::microseconds getMarkSliceBudget() const;
+
+        /**
+         * Set number of threads used to mark heap in stop the world collections, 1 means marking on calling thread
+         * only, helper threads are started here and wait between collections
+         */
+        void setMarkThreads(size_t threads);
+        size_t getMarkThreads() const;
+
+        /**
+         * Set capacity of mark stack used by next collection, capacity is doubled after each overflow and kept
+         */
+        void setMarkStackCapacity(size_t capacity);
+        size_t getMarkStackCapacity() const;
+
+        /**
+         * Enables lazy sweeping, unreachable objects found by collections triggered by allocations are destroyed in
+         * small batches by following allocations instead of all at once, manual collections always sweep eagerly
+         */
+        void setLazySweep(bool enabled);
+        bool isLazySweep() const;
+
+        /**
+         * Enables background sweeping, unreachable objects are destroyed on dedicated sweeper thread.
+         * Objects found unreachable by the same collection are destroyed in unspecified order, so destructors must not
+         * access other managed objects, with background sweeping destructors run concurrently with owning thread
+         * and may run after garbageCollect returns, use waitForSweeper to wait for them
+         */
+        void setBackgroundSweep(bool enabled);
+        bool isBackgroundSweep() const;
+
+        /**
+         * Finishes pending sweeping and waits until sweeper thread destroyed all objects handed over to it
+         */
+        void waitForSweeper();
+
+        /**
+         * Enables finalizer thread, unreachable objects of sd::IsFinalizable types are destroyed on it instead of
+         * waiting in finalization queue for runFinalizers
+         */
+        void setFinalizerThread(bool enabled);
+        bool isFinalizerThread() const;
+
+        /**
+         * Destroys unreachable finalizable objects waiting in finalization queue until queue is empty or time budget
+         * is exceeded, at least one object is destroyed if queue is not empty, returns number of destroyed objects.
+         * Destructors must not access other managed objects, memory of queued objects is already counted as freed
+         */
+        size_t runFinalizers(std::chrono::microseconds budget = std::chrono::microseconds::max());
+        size_t getPendingFinalizers();
+
+        /**
+         * Get longest pause observed in collection or marking slice
+         */
+        std::chrono::nanoseconds getMaxPause() const;
+
+        /**
+         * Get cumulative collection statistics
+         */
+        const Stats &stats() const;
+        void resetStats();
+
+        /**
+         * Set function called after each finished collection, it must not allocate managed objects
+         */
+        void setCollectionCallback(std::function<void(const CollectionStats &)> callback);
+
+        /**
+         * Write barrier used by sd::GcPtr, remembers slot if old object starts pointing to young one and shades target
+         * during incremental marking
+         */
+        void writeBarrier(void *slot, void *target);
+
+        /**
+         * Enables precise roots mode, stacks are not scanned and only objects reachable from explicit roots
+         * (sd::GcRoot) survive collections, pointers kept only in local variables do not keep objects alive
+         */
+        void setPreciseRootsMode(bool enabled);
+        bool isPreciseRootsMode() const;
+
+        /**
+         * Enables blacklisting, pages hit by values found during stack and range scanning which point into heap but not
+         * at any object are avoided by allocator until next collection, so they cannot falsely retain new objects
+         */
+        void setBlacklistingMode(bool enabled);
+        bool isBlacklistingMode() const;
+
+        /**
+         * Registers explicit root used by sd::GcRoot, node must stay at the same address until it is removed
+         */
+        void addRoot(RootNode &node);
+        void removeRoot(RootNode &node);
+
+        /**
+         * Registers memory range used by sd::GcScanRange, it is scanned for pointers like stack, also in precise roots
+         * mode. When collection runs on fiber stack, range containing stack pointer is scanned from it to its end, then
+         * stack of thread is not scanned and should be registered as range too if it holds references. Collection
+         * requested on fiber stack which is not registered is postponed until first allocation on known stack, memory
+         * limit is not raised meanwhile, O(1)
+         */
+        void addScanRange(ScanRange &range);
+        void removeScanRange(ScanRange &range);
+
+        /**
+         * Registers weak reference used by sd::GcWeak, slot is cleared by collection which finds its target unreachable
+         */
+        void addWeakSlot(WeakSlot &slot);
+        void removeWeakSlot(WeakSlot &slot);
+
+        /**
+         * Registers table used by sd::GcWeakMap, its values are traced only through live keys at the end of marking,
+         * then entries with dead keys are removed
+         */
+        void addEphemeronTable(IEphemeronTable &table);
+        void removeEphemeronTable(IEphemeronTable &table);
+
+      private:
+        /**
+         * Temporary root of object being allocated, it is referenced only by local variable while collection triggered
+         * by its allocation runs, so precise roots mode would free it and compaction could move it
+         */
+        class AllocationRoot
+        {
+          private:
+            MemoryManager &_manager;
+            RootNode _node;
+
+          public:
+            template <class T> AllocationRoot(MemoryManager &manager, T *&ptr) : _manager(manager)
+            {
+                _node.slot = reinterpret_cast<void **>(&ptr);
+                _manager.addRoot(_node);
+            }
+            AllocationRoot(const AllocationRoot &) = delete;
+            AllocationRoot &operator=(const AllocationRoot &) = delete;
+            ~AllocationRoot() { _manager.removeRoot(_node); }
+        };
+
+        /**
+         * Counts old objects under construction, their holders are not registered yet, so write barrier can not tell
+         * them apart from young objects sharing their chunk
+         */
+        class TenuredConstruction
+        {
+          private:
+            MemoryManager &_manager;
+
+          public:
+            explicit TenuredConstruction(MemoryManager &manager) : _manager(manager)
+            {
+                _manager._tenuredConstructions++;
+            }
+            TenuredConstruction(const TenuredConstruction &) = delete;
+            TenuredConstruction &operator=(const TenuredConstruction &) = delete;
+            ~TenuredConstruction() { _manager._tenuredConstructions--; }
+        };
+
+        template <class Holder, class... Args>
+        auto allocateObject(bool pointerFree, bool tenured, size_t size, size_t alignment, Args &&...params)
+        {
+            if (_shared)
+            {
+                return createSharedObject<Holder>(pointerFree, size, alignment, std::forward<Args>(params)...);
+            }
+            bool young = !tenured && (_generational || _scopeDepth);
+            std::unique_ptr<Holder> objectHolderPtr;
+            if (young)
+            {
+                objectHolderPtr = createInNursery<Holder>(size, alignment, std::forward<Args>(params)...);
+            }
+            else
+            {
+                TenuredConstruction construction{*this};
+                objectHolderPtr = createInHeap<Holder>(size, alignment, std::forward<Args>(params)...);
+            }
+            if (pointerFree)
+            {
+                objectHolderPtr->setPointerFree();
+            }
+            auto ptr = objectHolderPtr->getTypedObjectPtr();
+            auto &objectHolder = *objectHolderPtr;
+            _allocatedMemory += objectHolderPtr->getObjectSize();
+            if (_sampleInterval)
+            {
+                countSampledBytes(objectHolder);
+            }
+            if (_pressureThreshold)
+            {
+                countPressureBytes(objectHolder.getObjectSize());
+            }
+            if (young)
+            {
+                _youngMemory += objectHolderPtr->getObjectSize();
+                _youngObjects.push_back(objectHolderPtr.get());
+            }
+            else
+            {
+                // write barrier can not find owners of old objects outside chunks, minor collections of generational
+                // mode scan them as roots, scope collections without it scan all old objects anyway
+                objectHolder.promote();
+                if (_generational && !objectHolder.getChunk() && !objectHolder.isLarge())
+                {
+                    _untrackedObjects.insert(ptr);
+                }
+            }
+            _objectsRegister.registerObject(std::move(objectHolderPtr));
+            if (!_sweepList.empty())
+            {
+                sweepStep(LazySweepBatch);
+            }
+            if (!_marking && !_collectionPending && !isMinorCollectionNeeded() && !isGBCollectionNeeded())
+            {
+                return ptr;
+            }
+            AllocationRoot root{*this, ptr};
+            if (isMinorCollectionNeeded())
+            {
+                collect(true);
+            }
+            if (_marking)
+            {
+                markNewObject(objectHolder);
+                _markCredit += objectHolder.getObjectSize();
+                if (_markCredit >= MarkSliceBytes)
+                {
+                    incrementalMarkStep();
+                }
+            }
+            else if ((_collectionPending || isGBCollectionNeeded()) && _incremental)
+            {
+                startIncrementalCollection();
+            }
+            else if (_collectionPending || isGBCollectionNeeded())
+            {
+                collect(false);
+            }
+            // postponed collection did not free anything yet, growing limit now would keep heap large after it runs
+            if (!_marking && !_collectionPending && isGBCollectionNeeded())
+            {
+                bumpMemoryLimit();
+            }
+            return ptr;
+        }
+
+        template <class Holder, class... Args>
+        auto createSharedObject(bool pointerFree, size_t size, size_t alignment, Args &&...params)
+        {
+            safepoint();
+            auto record = currentThread();
+            if (record && size <= MaxCellSize && alignment <= 16 && !Holder::IsArray)
+            {
+                return createInTlab<Holder>(*record, pointerFree, std::forward<Args>(params)...);
+            }
+            std::unique_ptr<Holder> objectHolderPtr = Holder::create(std::forward<Args>(params)...);
+            if (pointerFree)
+            {
+                objectHolderPtr->setPointerFree();
+            }
+            auto ptr = objectHolderPtr->getTypedObjectPtr();
+            bool collectionNeeded = false;
+            {
+                std::lock_guard lock{_heapMutex};
+                _allocatedMemory += objectHolderPtr->getObjectSize();
+                if (_sampleInterval)
+                {
+                    countSampledBytes(*objectHolderPtr);
+                }
+                if (_pressureThreshold)
+                {
+                    countPressureBytes(objectHolderPtr->getObjectSize());
+                }
+                _objectsRegister.registerObject(std::move(objectHolderPtr));
+                collectionNeeded = isGBCollectionNeeded();
+                updateTlabRoom();
+            }
+            if (collectionNeeded)
+            {
+                AllocationRoot root{*this, ptr};
+                sharedGarbageCollect(true);
+            }
+            return ptr;
+        }
+
+        /**
+         * Allocation fast path of shared heap, takes no lock, new objects stay in thread record until collection
+         * registers them, only every TlabFlushBytes their size is added to shared counter
+         */
+        template <class Holder, class... Args>
+        auto createInTlab(ThreadRecord &record, bool pointerFree, Args &&...params)
+        {
+            std::unique_ptr<Holder> objectHolderPtr;
+            if (record.tlab)
+            {
+                objectHolderPtr = Holder::createIn(*record.tlab, std::forward<Args>(params)...);
+            }
+            if (!objectHolderPtr)
+            {
+                record.tlab = &takeTlabChunk();
+                objectHolderPtr = Holder::createIn(*record.tlab, std::forward<Args>(params)...);
+            }
+            if (pointerFree)
+            {
+                objectHolderPtr->setPointerFree();
+            }
+            auto ptr = objectHolderPtr->getTypedObjectPtr();
+            if (_sampleInterval)
+            {
+                countSampledBytes(record, *objectHolderPtr);
+            }
+            auto size = objectHolderPtr->getObjectSize();
+            record.pendingBytes += size;
+            record.unreportedBytes += size;
+            record.pendingObjects.push_back(std::move(objectHolderPtr));
+            if (record.unreportedBytes >= TlabFlushBytes)
+            {
+                auto waiting = _tlabBytes.fetch_add(record.unreportedBytes, std::memory_order_relaxed);
+                waiting += record.unreportedBytes;
+                record.unreportedBytes = 0;
+                if (waiting > _tlabRoom.load(std::memory_order_relaxed))
+                {
+                    AllocationRoot root{*this, ptr};
+                    sharedGarbageCollect(true);
+                }
+            }
+            return ptr;
+        }
+
+        template <class Holder, class... Args>
+        std::unique_ptr<Holder> createInHeap(size_t size, size_t alignment, Args &&...params)
+        {
+            if (size >= LargeObjectSize && alignment <= PageSize)
+            {
+                return createLargeObject<Holder>(size, std::forward<Args>(params)...);
+            }
+            if (size > MaxCellSize || alignment > 16)
+            {
+                return Holder::create(std::forward<Args>(params)...);
+            }
+            auto sizeClass = getSizeClass(size);
+            while (true)
+            {
+                auto &chunk = getCellChunk(sizeClass);
+                if (auto holder = Holder::createIn(chunk, std::forward<Args>(params)...))
+                {
+                    return holder;
+                }
+                // all free cells left in chunk were on blacklisted pages
+                _cellChunks[sizeClass] = nullptr;
+            }
+        }
+
+        template <class Holder, class... Args>
+        std::unique_ptr<Holder> createInNursery(size_t size, size_t alignment, Args &&...params)
+        {
+            if (size >= LargeObjectSize && alignment <= PageSize)
+            {
+                // large objects are young too, but they are never moved so promotion only flips their flag
+                return createLargeObject<Holder>(size, std::forward<Args>(params)...);
+            }
+            if (size <= MaxCellSize && alignment <= 16)
+            {
+                // survivors are promoted in place, cells of dead young objects are reused like any other
+                return createInHeap<Holder>(size, alignment, std::forward<Args>(params)...);
+            }
+            if (_nurseryChunk)
+            {
+                if (auto objectHolderPtr = Holder::createIn(*_nurseryChunk, std::forward<Args>(params)...))
+                {
+                    return objectHolderPtr;
+                }
+            }
+            if (!_sweepList.empty())
+            {
+                // nursery chunk may become free once pending sweep is done
+                finishSweep();
+                return createInNursery<Holder>(size, alignment, std::forward<Args>(params)...);
+            }
+            auto &chunk = allocateChunk(size + alignment);
+            if (size + alignment <= Chunk::Size / 2)
+            {
+                _nurseryChunk = &chunk;
+            }
+            return Holder::createIn(chunk, std::forward<Args>(params)...);
+        }
+
+        template <class Holder, class... Args> std::unique_ptr<Holder> createLargeObject(size_t size, Args &&...params)
+        {
+            if (!_sweepList.empty())
+            {
+                // swept large objects are unmapped but stay registered until sweep finishes, new mapping may reuse
+                // their address
+                finishSweep();
+            }
+            auto objectHolderPtr = Holder::createLarge(std::forward<Args>(params)...);
+            _largeObjects[reinterpret_cast<uintptr_t>(objectHolderPtr->getObjectPtr())] = objectHolderPtr.get();
+            _reservedMemory += getLargeObjectMappedSize(size);
+            _residentMemory += getLargeObjectMappedSize(size);
+            return objectHolderPtr;
+        }
+
+        void destroyObject(IObjectHolder &objectHolder);
         void clear();
 
+        void countSampledBytes(IObjectHolder &objectHolder);
+        void countSampledBytes(ThreadRecord &record, IObjectHolder &objectHolder);
+        void sampleAllocation(IObjectHolder &objectHolder, std::vector<void *> frames);
+        void forgetSampledObject(IObjectHolder &objectHolder);
+
+        void countPressureBytes(size_t bytes);
+        void checkMemoryPressure();
+        void openPressureFile();
+        void closePressureFile();
+
         bool isGBCollectionNeeded();
-        void mark();
+        bool isMinorCollectionNeeded();
+        void collect(bool minor);
+        void mark(bool minor = false);
+        void pushRoots(bool minor);
+        // returns false when deadline passed or, if work is given, objects of its size were scanned before marking
+        // finished, sizes of scanned objects are subtracted from work
+        bool drainMarkStack(bool minor,
+                            std::chrono::steady_clock::time_point deadline =
+                                std::chrono::steady_clock::time_point::max(),
+                            size_t *workBytes = nullptr);
+        void pushChildren(const IObjectHolder &objectHolder, bool onlyUnmarked = false, bool minor = false);
+        void rescanMarkedObjects(bool minor);
+        void parallelDrainMarkStack(bool minor);
+        void startIncrementalCollection();
+        void incrementalMarkStep();
+        void markNewObject(IObjectHolder &objectHolder);
+        void processWeakReferences(bool minor);
+        bool isAliveAfterMark(void *ptr, bool minor) const;
+        std::unique_lock<std::recursive_mutex> lockRoots();
+        void recordPause(std::chrono::steady_clock::time_point start);
+        void finishCollectionStats();
+
+        static ThreadRecord *currentThread();
+        static std::unique_ptr<ThreadRecord> &currentThreadRecord();
+        size_t sharedGarbageCollect(bool onlyIfNeeded);
+        Chunk &takeTlabChunk();
+        void flushTlab(ThreadRecord &record);
+        void retireTlabs();
+        void updateTlabRoom();
+        void stopTheWorld();
+        void resumeTheWorld();
+        void park(std::unique_lock<std::mutex> &lock, ThreadRecord &record);
         void sweep();
+        void minorSweep();
+        void sweepObject(IObjectHolder &objectHolder);
+        void compact();
+        void finishCollection();
+        void sweepStep(size_t count);
+        void finishSweep();
+        void enqueueFinalizers(std::vector<std::unique_ptr<IObjectHolder>> &objectHolders);
 
-        std::vector<void *> getRoots();
-        std::vector<void *> getInnerObjects(const IObjectHolder &objectHolder);
+        static constexpr size_t LazySweepBatch = 16;
+        static constexpr size_t MarkSliceBytes = 32 * 1024; // allocated while marking before next slice runs
+        static constexpr size_t MarkWorkRatio = 4;          // bytes of objects scanned by slice per allocated byte
+        static constexpr size_t TlabFlushBytes = 32 * 1024;
+        static constexpr size_t TlabRefillChunks = 4;
+        static constexpr size_t MemoryPressureCheckInterval = 256 * 1024;
+        static constexpr std::chrono::milliseconds MemoryPressureCheckPeriod{10};
+
+        Chunk &allocateChunk(size_t minSize, size_t cellSize = 0);
+        Chunk &getCellChunk(size_t sizeClass);
+        static size_t getSizeClass(size_t size);
+        static size_t getCellSize(size_t sizeClass);
+        Chunk *findChunk(void *ptr) const;
+        void reclaimChunks();
+        void releaseFreeChunks();
+
+        static void *mapLargeObject(size_t size);
+        static void unmapLargeObject(void *objectPtr, size_t size);
+        static size_t getLargeObjectMappedSize(size_t size);
+        IObjectHolder *findLargeObject(void *ptr) const;
+        void releaseLargeObject(IObjectHolder &objectHolder, bool destroy = true);
+
+        void getRoots(std::vector<void *> &result);
+        bool isStackScannable();
+        void scanStacks(std::vector<void *> &result);
+        void scanRanges(std::vector<void *> &result, const uint8_t *stackPointer = nullptr);
+        void scanStackRange(uint8_t *begin, uint8_t *end, std::vector<void *> &result) const;
+        void blacklistAddress(void *address) const;
+        void getInnerObjects(const IObjectHolder &objectHolder, std::vector<void *> &result) const;
+        template <class Fn> void forEachInnerObject(const IObjectHolder &objectHolder, Fn &&func) const;
 
-        size_t getMemoryLimit() const;
         void bumpMemoryLimit();
+        void updateMemoryLimit();
     };
 
     /**
@@ -158,4 +1690,365 @@ namespace sd
     {
         return MemoryManager::instance().createObject<T>(std::forward<Args>(params)...);
     }
+
+    /**
+     * Equivalent of sd::MemoryManager::instance().createAtomicObject<T>(args...), object is never scanned for pointers
+     */
+    template <class T, class... Args> T *makeAtomic(Args &&...params)
+    {
+        return MemoryManager::instance().createAtomicObject<T>(std::forward<Args>(params)...);
+    }
+
+    /**
+     * Explicit root keeping managed object alive wherever handle is stored: globals, std containers or unmanaged heap.
+     * Root is registered in memory manager of thread creating it, assignments need no write barrier because roots are
+     * scanned again before every sweep
+     */
+    template <class T> class GcRoot
+    {
+      private:
+        T *_ptr = nullptr;
+        MemoryManager::RootNode _node;
+
+      public:
+        GcRoot(T *ptr = nullptr) : _ptr(ptr)
+        {
+            _node.slot = reinterpret_cast<void **>(&_ptr);
+            MemoryManager::instance().addRoot(_node);
+        }
+        GcRoot(const GcRoot &other) : GcRoot(other.get()) {}
+        ~GcRoot()
+        {
+            // manager could be destroyed already, for example on thread exit
+            if (_node.manager)
+            {
+                _node.manager->removeRoot(_node);
+            }
+        }
+
+        GcRoot &operator=(const GcRoot &other) { return *this = other.get(); }
+        GcRoot &operator=(T *ptr)
+        {
+            _ptr = ptr;
+            return *this;
+        }
+
+        T *get() const { return _ptr; }
+        T *operator->() const { return _ptr; }
+        T &operator*() const { return *_ptr; }
+        operator T *() const { return _ptr; }
+        explicit operator bool() const { return _ptr; }
+    };
+
+    /**
+     * Weak reference to managed object, it does not keep object alive and is cleared by collection which finds object
+     * unreachable. Pointer is stored hidden, so weak reference can be kept also in managed objects and on stack
+     */
+    template <class T> class GcWeak
+    {
+      private:
+        MemoryManager::WeakSlot _slot;
+
+      public:
+        GcWeak(T *ptr = nullptr)
+        {
+            _slot.hiddenPtr = MemoryManager::hidePointer(ptr);
+            MemoryManager::instance().addWeakSlot(_slot);
+        }
+        GcWeak(const GcWeak &other) : GcWeak(other.get()) {}
+        ~GcWeak()
+        {
+            if (_slot.manager)
+            {
+                _slot.manager->removeWeakSlot(_slot);
+            }
+        }
+
+        GcWeak &operator=(const GcWeak &other) { return *this = other.get(); }
+        GcWeak &operator=(T *ptr)
+        {
+            _slot.hiddenPtr = MemoryManager::hidePointer(ptr);
+            return *this;
+        }
+
+        /**
+         * Get target object or nullptr if it was collected, returned pointer keeps object alive as any other
+         */
+        T *get() const { return static_cast<T *>(MemoryManager::revealPointer(_slot.hiddenPtr)); }
+        bool expired() const { return !get(); }
+    };
+
+    /**
+     * Map from managed objects to values, keys are held weakly and values are reachable only through their live keys,
+     * so value pointing back to its key does not keep entry alive. Entries with collected keys are removed by
+     * collections. Values are scanned conservatively, but memory they own (like std::vector buffer) is not
+     */
+    template <class K, class V> class GcWeakMap : private MemoryManager::IEphemeronTable
+    {
+      private:
+        struct Entry
+        {
+            V value;
+            size_t tracedEpoch = 0;
+        };
+
+        std::unordered_map<uintptr_t, Entry> _entries;
+        MemoryManager *_manager = nullptr;
+
+        bool traceValues(size_t epoch, const std::function<bool(void *)> &isAlive,
+                         const std::function<void(const void *, size_t)> &scan) override
+        {
+            bool traced = false;
+            for (auto &[hiddenKey, entry] : _entries)
+            {
+                if (entry.tracedEpoch != epoch && isAlive(MemoryManager::revealPointer(hiddenKey)))
+                {
+                    entry.tracedEpoch = epoch;
+                    scan(&entry.value, sizeof(V));
+                    traced = true;
+                }
+            }
+            return traced;
+        }
+
+        void removeDeadEntries(const std::function<bool(void *)> &isAlive) override
+        {
+            std::erase_if(_entries,
+                          [&](auto &pair) { return !isAlive(MemoryManager::revealPointer(pair.first)); });
+        }
+
+        void detach() override { _manager = nullptr; }
+
+      public:
+        GcWeakMap() : _manager(&MemoryManager::instance()) { _manager->addEphemeronTable(*this); }
+        ~GcWeakMap()
+        {
+            if (_manager)
+            {
+                _manager->removeEphemeronTable(*this);
+            }
+        }
+        GcWeakMap(const GcWeakMap &) = delete;
+        GcWeakMap &operator=(const GcWeakMap &) = delete;
+
+        void insert(K *key, V value)
+        {
+            _entries.insert_or_assign(MemoryManager::hidePointer(key), Entry{std::move(value)});
+        }
+
+        /**
+         * Get pointer to value of key or nullptr if key is not in map
+         */
+        V *find(K *key)
+        {
+            auto it = _entries.find(MemoryManager::hidePointer(key));
+            return it != _entries.end() ? &it->second.value : nullptr;
+        }
+
+        bool contains(K *key) const { return _entries.contains(MemoryManager::hidePointer(key)); }
+        void remove(K *key) { _entries.erase(MemoryManager::hidePointer(key)); }
+        void clear() { _entries.clear(); }
+
+        size_t size() const { return _entries.size(); }
+        bool empty() const { return _entries.empty(); }
+    };
+
+    /**
+     * Equivalent of sd::MemoryManager::instance().createArray<T>(length)
+     */
+    template <class T> T *makeArray(size_t length) { return MemoryManager::instance().createArray<T>(length); }
+
+    /**
+     * Get number of elements of array created by sd::makeArray
+     */
+    template <class T> size_t arrayLength(const T *array) { return MemoryManager::instance().getArrayLength(array); }
+
+    /**
+     * Get array with at least minLength elements, if array is too short new one is created with capacity grown
+     * geometrically and elements are moved to it, old array is left to be collected
+     */
+    template <class T> T *growArray(T *array, size_t minLength)
+    {
+        auto length = arrayLength(array);
+        if (length >= minLength)
+        {
+            return array;
+        }
+        auto grown = makeArray<T>(std::max(minLength, length * 2));
+        std::move(array, array + length, grown);
+        return grown;
+    }
+
+    /**
+     * Allocator of single nodes on managed heap for node based containers (sd::List, sd::Map), nodes are traced like
+     * other managed objects, so container itself has to be reachable (on stack, inside managed object or sd::GcRoot).
+     * Deallocated nodes are reclaimed by collector, collected nodes still holding element destroy it. Containers link
+     * nodes by raw pointers, so nodes are created in old generation and only full collections reclaim them, elements
+     * referring young objects have to use sd::GcPtr
+     */
+    template <class T> class GcAllocator
+    {
+      private:
+        // element is placed first, so pointer to element is pointer to managed object
+        struct Slot
+        {
+            union {
+                T value;
+            };
+            bool constructed = false;
+
+            Slot() {}
+            ~Slot()
+            {
+                if (constructed)
+                {
+                    value.~T();
+                }
+            }
+        };
+
+      public:
+        using value_type = T;
+        static constexpr bool isGarbageCollected = true;
+
+        GcAllocator() = default;
+        template <class U> GcAllocator(const GcAllocator<U> &) {}
+
+        T *allocate(size_t n)
+        {
+            if (n != 1)
+            {
+                throw std::bad_array_new_length();
+            }
+            return &MemoryManager::instance().createTenuredObject<Slot>()->value;
+        }
+        // node may be still pointed by conservatively scanned memory, it is left to collector
+        void deallocate(T *, size_t) {}
+
+        template <class... Args> void construct(T *ptr, Args &&...args)
+        {
+            new (ptr) T(std::forward<Args>(args)...);
+            reinterpret_cast<Slot *>(ptr)->constructed = true;
+        }
+        void destroy(T *ptr)
+        {
+            reinterpret_cast<Slot *>(ptr)->constructed = false;
+            ptr->~T();
+        }
+
+        template <class U> bool operator==(const GcAllocator<U> &) const { return true; }
+    };
+
+    /**
+     * Equivalent of sd::MemoryManager::safepoint(), parks calling thread if shared heap collection is in progress
+     */
+    inline void gcSafepoint() { MemoryManager::safepoint(); }
+
+    /**
+     * Region of scope local allocations, objects made inside it which did not escape are collected when outermost
+     * scope ends, see sd::MemoryManager::enterScope
+     */
+    class GcScope
+    {
+      private:
+        MemoryManager &_manager;
+
+      public:
+        GcScope() : _manager(MemoryManager::instance()) { _manager.enterScope(); }
+        ~GcScope() { _manager.leaveScope(); }
+        GcScope(const GcScope &) = delete;
+        GcScope &operator=(const GcScope &) = delete;
+    };
+
+    /**
+     * Memory range scanned for references to managed objects for lifetime of handle, for example stack of fiber or
+     * frame of coroutine, see sd::MemoryManager::addScanRange
+     */
+    class GcScanRange
+    {
+      private:
+        MemoryManager::ScanRange _range;
+
+      public:
+        GcScanRange(void *begin = nullptr, void *end = nullptr)
+        {
+            set(begin, end);
+            MemoryManager::instance().addScanRange(_range);
+        }
+        ~GcScanRange()
+        {
+            // manager could be destroyed already, for example on thread exit
+            if (_range.manager)
+            {
+                _range.manager->removeScanRange(_range);
+            }
+        }
+        GcScanRange(const GcScanRange &) = delete;
+        GcScanRange &operator=(const GcScanRange &) = delete;
+
+        /**
+         * Changes scanned bounds without registering range again, cheap enough to call on every fiber switch
+         */
+        void set(void *begin, void *end)
+        {
+            _range.begin = begin;
+            _range.end = end;
+        }
+
+        void *begin() const { return _range.begin; }
+        void *end() const { return _range.end; }
+    };
+
+    /**
+     * Registers calling thread in shared heap for lifetime of scope
+     */
+    class GcThreadScope
+    {
+      public:
+        GcThreadScope() { MemoryManager::registerThread(); }
+        ~GcThreadScope() { MemoryManager::unregisterThread(); }
+        GcThreadScope(const GcThreadScope &) = delete;
+        GcThreadScope &operator=(const GcThreadScope &) = delete;
+    };
+
+    /**
+     * Keeps calling thread in safe region for lifetime of scope, use around blocking calls of registered threads
+     */
+    class GcSafeRegion
+    {
+      public:
+        GcSafeRegion() { MemoryManager::enterSafeRegion(); }
+        ~GcSafeRegion() { MemoryManager::leaveSafeRegion(); }
+        GcSafeRegion(const GcSafeRegion &) = delete;
+        GcSafeRegion &operator=(const GcSafeRegion &) = delete;
+    };
+
+    /**
+     * Pointer to managed object to be stored inside other managed objects, assignments go through write barrier so
+     * minor collections will see pointers from old objects to young ones
+     */
+    template <class T> class GcPtr
+    {
+      private:
+        T *_ptr = nullptr;
+
+      public:
+        GcPtr() = default;
+        GcPtr(T *ptr) { *this = ptr; }
+        GcPtr(const GcPtr &other) { *this = other.get(); }
+
+        GcPtr &operator=(const GcPtr &other) { return *this = other.get(); }
+        GcPtr &operator=(T *ptr)
+        {
+            _ptr = ptr;
+            MemoryManager::instance().writeBarrier(&_ptr, ptr);
+            return *this;
+        }
+
+        T *get() const { return _ptr; }
+        T *operator->() const { return _ptr; }
+        T &operator*() const { return *_ptr; }
+        operator T *() const { return _ptr; }
+        explicit operator bool() const { return _ptr; }
+    };
 } // namespace sd
\ No newline at end of file
@@ -2,11 +2,20 @@
 #include <gtest/gtest.h>
 #include <iostream>
 #include <memory>
+#include <mutex>
+#include <sstream>
 #include <thread>
 #include <vector>
 
+#include "DetectOs.hpp"
+#include "LinkedList.hpp"
+#include "Map.hpp"
 #include "MemoryManager.hpp"
 
+#ifdef LINUX
+#include <ucontext.h>
+#endif
+
 struct ExampleClass
 {
     ExampleClass *ptr = nullptr;
@@ -205,4 +214,1282 @@ TEST_F(MemoryManagerTest, ManagersShouldWorkInSeparateThreads)
     EXPECT_EQ(limit, destructorR1.size());
     EXPECT_EQ(limit, destructorR2.size());
     EXPECT_EQ(0, collectedCnt());
-}
\ No newline at end of file
+}
+
+struct GenerationalExample
+{
+    sd::GcPtr<ExampleClass> ptr;
+    std::vector<ExampleClass *> &collectedObjects;
+
+    GenerationalExample(std::vector<ExampleClass *> &vec) : collectedObjects(vec) {}
+};
+
+class MemoryManagerGenerationalTest : public MemoryManagerTest
+{
+  protected:
+    void SetUp() override
+    {
+        MemoryManagerTest::SetUp();
+        sd::MemoryManager::instance().setGenerationalMode(true);
+    }
+
+    void TearDown() override
+    {
+        sd::MemoryManager::instance().setGenerationalMode(false);
+        MemoryManagerTest::TearDown();
+    }
+};
+
+TEST_F(MemoryManagerGenerationalTest, MinorCollectionShouldCollectYoungObjects)
+{
+    for (int i = 0; i < 100; i++)
+    {
+        make();
+    }
+
+    sd::MemoryManager::instance().minorGarbageCollect();
+
+    EXPECT_LE(1, collectedCnt());
+    EXPECT_EQ(0, sd::MemoryManager::instance().getYoungMemory());
+}
+
+TEST_F(MemoryManagerGenerationalTest, MinorCollectionShouldNotCollectReachableObjects)
+{
+    auto circle = make(nullptr);
+    circle->ptr = make(nullptr);
+    circle->ptr->ptr = make(nullptr);
+
+    sd::MemoryManager::instance().minorGarbageCollect();
+
+    EXPECT_FALSE(wasCollected({circle, circle->ptr, circle->ptr->ptr}));
+}
+
+TEST_F(MemoryManagerGenerationalTest, MinorCollectionShouldNotCollectPromotedObjects)
+{
+    auto old = make();
+
+    sd::MemoryManager::instance().minorGarbageCollect();
+    auto promoted = old;
+    old = nullptr;
+    sd::MemoryManager::instance().minorGarbageCollect();
+
+    EXPECT_FALSE(wasCollected({promoted}));
+}
+
+TEST_F(MemoryManagerGenerationalTest, MinorCollectionShouldKeepObjectsReferencedFromOldGeneration)
+{
+    auto old = sd::make<GenerationalExample>(getCollectedObjects());
+    sd::MemoryManager::instance().minorGarbageCollect();
+
+    old->ptr = make();
+    auto young = old->ptr.get();
+    sd::MemoryManager::instance().minorGarbageCollect();
+
+    EXPECT_FALSE(wasCollected({young}));
+    EXPECT_EQ(young, old->ptr.get());
+}
+
+TEST_F(MemoryManagerGenerationalTest, MinorCollectionShouldBeTriggeredAutomatically)
+{
+    auto limit = 500 * 1024 / sizeof(ExampleClass);
+    for (int i = 0; i < limit; i++) // allocate ~0.5 MB, more than nursery but less than memory limit
+    {
+        make();
+    }
+
+    EXPECT_LE(1, collectedCnt());
+    EXPECT_GE(sd::MemoryManager::instance().getNurserySize(), sd::MemoryManager::instance().getYoungMemory());
+}
+
+TEST_F(MemoryManagerGenerationalTest, PromotedObjectsShouldNotKeepNurseryMemory)
+{
+    auto &manager = sd::MemoryManager::instance();
+    manager.garbageCollect();
+    auto resident = manager.getResidentMemory();
+
+    // cells of dead objects are reused, so survivors report their destruction separately
+    static std::vector<ExampleClass *> collectedSurvivors;
+    collectedSurvivors.clear();
+    ExampleClass *survivors = nullptr;
+    auto nurseryObjects = manager.getNurserySize() / sizeof(ExampleClass);
+    for (int round = 0; round < 32; round++)
+    {
+        // one object of each nursery is promoted, all others die young
+        survivors = sd::make<ExampleClass>(collectedSurvivors, survivors);
+        for (size_t i = 0; i < nurseryObjects; i++)
+        {
+            make();
+        }
+        manager.minorGarbageCollect();
+    }
+
+    EXPECT_TRUE(collectedSurvivors.empty());
+    EXPECT_GT(resident + 2 * 1024 * 1024, manager.getResidentMemory());
+}
+
+struct IncrementalExample
+{
+    sd::GcPtr<IncrementalExample> ptr;
+    char payload[64] = {};
+};
+
+class MemoryManagerIncrementalTest : public MemoryManagerTest
+{
+  protected:
+    void SetUp() override
+    {
+        MemoryManagerTest::SetUp();
+        sd::MemoryManager::instance().setIncrementalMode(true);
+    }
+
+    void TearDown() override
+    {
+        sd::MemoryManager::instance().setIncrementalMode(false);
+        MemoryManagerTest::TearDown();
+    }
+};
+
+TEST_F(MemoryManagerIncrementalTest, IncrementalCollectionShouldCollectObjects)
+{
+    auto limit = 1500 * 1024 / sizeof(ExampleClass);
+    for (int i = 0; i < limit; i++) // allocate ~1.5 MB
+    {
+        make();
+    }
+
+    EXPECT_LE(1, collectedCnt());
+}
+
+TEST_F(MemoryManagerIncrementalTest, IncrementalCollectionShouldNotCollectReachableObjects)
+{
+    sd::MemoryManager::instance().setMarkSliceBudget(std::chrono::microseconds{1});
+    auto head = sd::make<IncrementalExample>();
+    auto tail = head;
+    std::vector<IncrementalExample *> chain{head};
+    auto limit = 1500 * 1024 / sizeof(IncrementalExample);
+    for (int i = 0; i < limit; i++) // allocate ~1.5 MB, part of it stays reachable through barriered pointers
+    {
+        auto ob = sd::make<IncrementalExample>();
+        if (i % 16 == 0)
+        {
+            tail->ptr = ob;
+            tail = ob;
+            chain.push_back(ob);
+        }
+    }
+    sd::MemoryManager::instance().garbageCollect();
+
+    auto current = head;
+    for (auto ob : chain)
+    {
+        ASSERT_EQ(ob, current);
+        current = current->ptr;
+    }
+    EXPECT_EQ(nullptr, current);
+    sd::MemoryManager::instance().setMarkSliceBudget(std::chrono::microseconds{200});
+}
+
+TEST_F(MemoryManagerIncrementalTest, MarkSlicesShouldRunInProportionToAllocatedBytes)
+{
+    auto &manager = sd::MemoryManager::instance();
+    // live objects take several slices to mark
+    constexpr size_t length = 4000;
+    sd::GcRoot<IncrementalExample *> live = sd::makeArray<IncrementalExample *>(length);
+    for (size_t i = 0; i < length; i++)
+    {
+        live.get()[i] = sd::make<IncrementalExample>();
+    }
+    auto slices = manager.stats().incrementalSlices;
+    for (int i = 0; i < 10000000 && manager.stats().incrementalSlices == slices; i++)
+    {
+        make();
+    }
+    slices = manager.stats().incrementalSlices;
+    auto collections = manager.stats().collections;
+    size_t allocated = 0;
+    for (int i = 0; i < 10000000 && manager.stats().collections == collections; i++)
+    {
+        make();
+        allocated += sizeof(ExampleClass);
+    }
+
+    EXPECT_LT(collections, manager.stats().collections);
+    EXPECT_LT(slices, manager.stats().incrementalSlices);
+    EXPECT_GT(allocated / 1024, manager.stats().incrementalSlices - slices);
+}
+
+TEST_F(MemoryManagerIncrementalTest, ManagerShouldReportMaxPause)
+{
+    make();
+    sd::MemoryManager::instance().garbageCollect();
+
+    EXPECT_LT(0, sd::MemoryManager::instance().getMaxPause().count());
+}
+
+TEST_F(MemoryManagerTest, ParallelMarkingShouldNotCollectReachableObjects)
+{
+    sd::MemoryManager::instance().setMarkThreads(4);
+    auto head = make(nullptr);
+    std::vector<ExampleClass *> chain{head};
+    for (int i = 0; i < 2000; i++)
+    {
+        chain.back()->ptr = make(nullptr);
+        chain.push_back(chain.back()->ptr);
+        make(); // garbage
+    }
+
+    // helper threads wait between collections and are reused
+    for (int i = 0; i < 3; i++)
+    {
+        sd::MemoryManager::instance().garbageCollect();
+    }
+    sd::MemoryManager::instance().setMarkThreads(1);
+
+    EXPECT_FALSE(wasCollected(chain));
+    EXPECT_LE(1, collectedCnt());
+}
+
+TEST_F(MemoryManagerTest, LazySweepShouldCollectObjectsDuringAllocations)
+{
+    sd::MemoryManager::instance().setLazySweep(true);
+    auto limit = 1500 * 1024 / sizeof(ExampleClass);
+    for (int i = 0; i < limit; i++) // allocate ~1.5 MB
+    {
+        make();
+    }
+    sd::MemoryManager::instance().setLazySweep(false);
+
+    EXPECT_LE(1, collectedCnt());
+}
+
+TEST_F(MemoryManagerTest, LazySweepShouldNotCollectReachableObjects)
+{
+    sd::MemoryManager::instance().setLazySweep(true);
+    auto circle = make(nullptr);
+    circle->ptr = make(nullptr);
+    auto limit = 1500 * 1024 / sizeof(ExampleClass);
+    for (int i = 0; i < limit; i++) // allocate ~1.5 MB
+    {
+        make();
+    }
+    sd::MemoryManager::instance().setLazySweep(false);
+
+    EXPECT_FALSE(wasCollected({circle, circle->ptr}));
+}
+
+TEST_F(MemoryManagerTest, BackgroundSweepShouldCollectObjects)
+{
+    sd::MemoryManager::instance().setBackgroundSweep(true);
+    auto circle = make(nullptr);
+    circle->ptr = make(nullptr);
+    for (int i = 0; i < 100; i++)
+    {
+        make();
+    }
+
+    auto freedBytes = sd::MemoryManager::instance().garbageCollect();
+    sd::MemoryManager::instance().waitForSweeper();
+    sd::MemoryManager::instance().setBackgroundSweep(false);
+
+    EXPECT_EQ(freedBytes, collectedCnt() * sizeof(ExampleClass));
+    EXPECT_LE(1, collectedCnt());
+    EXPECT_FALSE(wasCollected({circle, circle->ptr}));
+}
+
+struct SharedExample
+{
+    struct Destructions
+    {
+        std::mutex mutex;
+        std::vector<SharedExample *> objects;
+    };
+
+    SharedExample *ptr = nullptr;
+    Destructions *destructions = nullptr;
+
+    ~SharedExample()
+    {
+        std::lock_guard lock{destructions->mutex};
+        destructions->objects.push_back(this);
+    }
+};
+
+TEST_F(MemoryManagerTest, SharedHeapShouldNotCollectObjectsUsedByOtherThreads)
+{
+    // shared heap is destroyed at exit and may already exist, destructions have to outlive objects retained until then
+    static auto &destructions = *new SharedExample::Destructions;
+    destructions.objects.clear();
+    sd::GcThreadScope scope;
+    auto shared = sd::make<SharedExample>(nullptr, &destructions);
+    shared->ptr = sd::make<SharedExample>(nullptr, &destructions);
+
+    auto limit = 1500 * 1024 / sizeof(SharedExample);
+    auto runner = [&]() {
+        sd::GcThreadScope scope;
+        for (int i = 0; i < limit; i++)
+        {
+            auto ob = sd::make<SharedExample>(shared, &destructions);
+            ASSERT_EQ(shared->ptr, ob->ptr->ptr);
+        }
+    };
+    {
+        std::thread r1{runner};
+        std::thread r2{runner};
+        sd::GcSafeRegion region;
+        r1.join();
+        r2.join();
+    }
+
+    auto &destroyed = destructions.objects;
+    EXPECT_LE(1, destroyed.size());
+    EXPECT_EQ(destroyed.end(), std::find(destroyed.begin(), destroyed.end(), shared));
+    EXPECT_EQ(destroyed.end(), std::find(destroyed.begin(), destroyed.end(), shared->ptr));
+    sd::MemoryManager::instance().garbageCollect();
+}
+
+TEST_F(MemoryManagerTest, SharedHeapShouldCollectObjectsFromAllocationBuffers)
+{
+    // shared heap may already exist, so static would be destroyed before objects retained until exit
+    static auto &destructions = *new SharedExample::Destructions;
+    destructions.objects.clear();
+    sd::GcThreadScope scope;
+    auto &manager = sd::MemoryManager::instance();
+    manager.garbageCollect();
+    auto allocated = manager.getAllocatedMemory();
+
+    // few objects stay in allocation buffer of thread until collection registers them
+    auto kept = sd::make<SharedExample>(nullptr, &destructions);
+    for (int i = 0; i < 10; i++)
+    {
+        sd::make<SharedExample>(kept, &destructions);
+    }
+    manager.garbageCollect();
+
+    auto &destroyed = destructions.objects;
+    EXPECT_LE(1, destroyed.size());
+    EXPECT_EQ(destroyed.end(), std::find(destroyed.begin(), destroyed.end(), kept));
+    EXPECT_LE(allocated + sizeof(SharedExample), manager.getAllocatedMemory());
+}
+
+TEST_F(MemoryManagerTest, SharedHeapShouldCountAllocationBuffersBeforeTheyAreRegistered)
+{
+    static auto &destructions = *new SharedExample::Destructions;
+    sd::GcThreadScope scope;
+    auto &manager = sd::MemoryManager::instance();
+    manager.garbageCollect();
+    auto allocated = manager.getAllocatedMemory();
+    auto objects = manager.getObjectsCount();
+    auto collections = manager.stats().collections;
+
+    // holders wait in thread record, only their size is reported every 32 KB
+    for (size_t i = 0; i < 64 * 1024 / sizeof(SharedExample); i++)
+    {
+        sd::make<SharedExample>(nullptr, &destructions);
+    }
+
+    ASSERT_EQ(collections, manager.stats().collections);
+    EXPECT_LE(allocated + 32 * 1024, manager.getAllocatedMemory());
+    EXPECT_EQ(objects, manager.getObjectsCount());
+    manager.garbageCollect();
+    EXPECT_GT(allocated + 32 * 1024, manager.getAllocatedMemory());
+}
+
+TEST_F(MemoryManagerTest, SharedHeapShouldSampleAllocationsAtTheirSites)
+{
+    static auto &destructions = *new SharedExample::Destructions;
+    sd::GcThreadScope scope;
+    auto &manager = sd::MemoryManager::instance();
+    manager.resetAllocationSites();
+    manager.setAllocationSampleInterval(1);
+
+    // objects wait in allocation buffer, so samples are recorded by collection flushing it
+    for (int i = 0; i < 5; i++)
+    {
+        sd::make<SharedExample>(nullptr, &destructions);
+    }
+    for (int i = 0; i < 5; i++)
+    {
+        sd::make<SharedExample>(nullptr, &destructions);
+    }
+    manager.garbageCollect();
+    manager.setAllocationSampleInterval(0);
+
+    auto sites = manager.getAllocationSites();
+    manager.resetAllocationSites();
+    ASSERT_EQ(2, sites.size());
+    for (auto &site : sites)
+    {
+        EXPECT_EQ("SharedExample", site.type);
+        EXPECT_EQ(5, site.samples);
+    }
+}
+
+TEST_F(MemoryManagerTest, ManagerShouldCountCollections)
+{
+    auto &manager = sd::MemoryManager::instance();
+    manager.resetStats();
+    auto circle = make(nullptr);
+    for (int i = 0; i < 100; i++)
+    {
+        make();
+    }
+
+    auto freedBytes = manager.garbageCollect();
+    manager.garbageCollect();
+
+    auto &stats = manager.stats();
+    EXPECT_EQ(2, stats.collections);
+    EXPECT_EQ(0, stats.minorCollections);
+    EXPECT_EQ(freedBytes, stats.freedBytes);
+    EXPECT_EQ(collectedCnt(), stats.freedObjects);
+    EXPECT_EQ(2, stats.pauses.count());
+    EXPECT_LE(stats.pauses.percentile(0.5), stats.pauses.percentile(0.99));
+    EXPECT_LE(stats.pauses.percentile(0.99), stats.pauses.max());
+    EXPECT_EQ(0, stats.lastCollection.freedObjects);
+    EXPECT_EQ(manager.getObjectsCount(), stats.lastCollection.survivedObjects);
+    EXPECT_FALSE(wasCollected({circle}));
+}
+
+TEST_F(MemoryManagerTest, ManagerShouldCallCollectionCallback)
+{
+    auto &manager = sd::MemoryManager::instance();
+    std::vector<sd::MemoryManager::CollectionStats> collections;
+    manager.setCollectionCallback([&](const auto &stats) { collections.push_back(stats); });
+    for (int i = 0; i < 100; i++)
+    {
+        make();
+    }
+
+    auto freedBytes = manager.garbageCollect();
+    manager.setCollectionCallback(nullptr);
+
+    ASSERT_EQ(1, collections.size());
+    EXPECT_EQ(freedBytes, collections[0].freedBytes);
+    EXPECT_FALSE(collections[0].minor);
+    EXPECT_LE(collections[0].markTime + collections[0].sweepTime, collections[0].pause);
+}
+
+TEST(PauseHistogram, ShouldComputePercentiles)
+{
+    sd::MemoryManager::PauseHistogram histogram;
+    for (int i = 1; i <= 100; i++)
+    {
+        histogram.record(std::chrono::microseconds{i});
+    }
+
+    EXPECT_EQ(100, histogram.count());
+    EXPECT_EQ(std::chrono::microseconds{100}, histogram.max());
+    EXPECT_NEAR(50000, histogram.percentile(0.5).count(), 50000 * 0.25);
+    EXPECT_NEAR(99000, histogram.percentile(0.99).count(), 99000 * 0.25);
+    EXPECT_EQ(histogram.max(), histogram.percentile(1));
+}
+
+TEST_F(MemoryManagerTest, PacingPolicyShouldGrowAndShrinkMemoryLimit)
+{
+    using Policy = sd::MemoryManager::GrowthFactorPacingPolicy;
+    auto &manager = sd::MemoryManager::instance();
+    size_t minLimit = 64 * 1024;
+    manager.setPacingPolicy(std::make_unique<Policy>(2.0, minLimit, SIZE_MAX, 2));
+    manager.garbageCollect();
+    manager.garbageCollect();
+    EXPECT_EQ(minLimit, manager.getMemoryLimit());
+
+    auto head = make(nullptr);
+    auto tail = head;
+    auto limit = 200 * 1024 / sizeof(ExampleClass);
+    for (int i = 0; i < limit; i++) // keep ~200 KB reachable
+    {
+        tail->ptr = make(nullptr);
+        tail = tail->ptr;
+    }
+    manager.garbageCollect();
+    auto grownLimit = manager.getMemoryLimit();
+    EXPECT_LE(2 * limit * sizeof(ExampleClass), grownLimit);
+
+    head->ptr = nullptr;
+    tail = nullptr;
+    manager.garbageCollect();
+    EXPECT_EQ(grownLimit, manager.getMemoryLimit());
+    manager.garbageCollect();
+    EXPECT_GT(grownLimit, manager.getMemoryLimit());
+
+    // restore default limit for other tests
+    manager.setPacingPolicy(std::make_unique<Policy>(2.0, 1024 * 1024, SIZE_MAX, 1));
+    manager.garbageCollect();
+    manager.setPacingPolicy(nullptr);
+    EXPECT_EQ(1024 * 1024, manager.getMemoryLimit());
+}
+
+TEST_F(MemoryManagerTest, PacingPolicyMaximumShouldNotBeExceededByAllocations)
+{
+    using Policy = sd::MemoryManager::GrowthFactorPacingPolicy;
+    auto &manager = sd::MemoryManager::instance();
+    size_t maxLimit = 128 * 1024;
+    manager.setPacingPolicy(std::make_unique<Policy>(2.0, maxLimit / 2, maxLimit, 1));
+    // live bytes alone are above maximum, so every allocation finds collection needed
+    sd::GcRoot<char> live = sd::makeArray<char>(2 * maxLimit);
+    manager.garbageCollect();
+    for (int i = 0; i < 100; i++)
+    {
+        make();
+    }
+    auto limit = manager.getMemoryLimit();
+
+    live = nullptr;
+    manager.setPacingPolicy(std::make_unique<Policy>(2.0, 1024 * 1024, SIZE_MAX, 1));
+    manager.garbageCollect();
+    manager.setPacingPolicy(nullptr);
+    EXPECT_EQ(maxLimit, limit);
+}
+
+TEST_F(MemoryManagerTest, MemoryPressureShouldForceCollection)
+{
+    using Policy = sd::MemoryManager::GrowthFactorPacingPolicy;
+    auto &manager = sd::MemoryManager::instance();
+    manager.garbageCollect();
+    manager.resetStats();
+    manager.setProcessMemoryLimit(1); // any process is above this limit
+    manager.setMemoryPressureThreshold(0.5);
+
+    auto limit = 512 * 1024 / sizeof(ExampleClass);
+    for (int i = 0; i < limit; i++) // ~512 KB of garbage, below memory limit
+    {
+        make(nullptr);
+    }
+    EXPECT_TRUE(manager.isUnderMemoryPressure());
+    EXPECT_LE(1, manager.stats().memoryPressureTriggers);
+    EXPECT_LE(1, manager.stats().collections);
+    EXPECT_GT(1024 * 1024, manager.getMemoryLimit());
+
+    manager.setMemoryPressureThreshold(0);
+    manager.setProcessMemoryLimit(0);
+    EXPECT_FALSE(manager.isUnderMemoryPressure());
+
+    // restore default limit for other tests
+    manager.setPacingPolicy(std::make_unique<Policy>(2.0, 1024 * 1024, SIZE_MAX, 1));
+    manager.garbageCollect();
+    manager.setPacingPolicy(nullptr);
+    EXPECT_EQ(1024 * 1024, manager.getMemoryLimit());
+}
+
+TEST_F(MemoryManagerTest, ManagerShouldReturnFreeChunksToOs)
+{
+    auto &manager = sd::MemoryManager::instance();
+    for (int i = 0; i < 50000; i++)
+    {
+        make();
+    }
+    auto resident = manager.getResidentMemory();
+    EXPECT_LE(resident, manager.getReservedMemory());
+
+    manager.garbageCollect();
+    manager.garbageCollect();
+    manager.garbageCollect();
+
+    EXPECT_GT(resident, manager.getResidentMemory());
+    EXPECT_GT(manager.getReservedMemory(), manager.getResidentMemory());
+}
+
+struct LargeExample
+{
+    static inline size_t destructions = 0;
+
+    sd::GcPtr<ExampleClass> ptr;
+    char payload[256 * 1024] = {};
+
+    ~LargeExample() { destructions++; }
+};
+
+TEST_F(MemoryManagerTest, LargeObjectsShouldBeUnmappedWhenCollected)
+{
+    auto &manager = sd::MemoryManager::instance();
+    manager.garbageCollect();
+    auto reserved = manager.getReservedMemory();
+    LargeExample::destructions = 0;
+
+    for (int i = 0; i < 3; i++)
+    {
+        sd::make<LargeExample>();
+    }
+    manager.garbageCollect();
+
+    EXPECT_LE(1, LargeExample::destructions);
+    EXPECT_GE(reserved + (3 - LargeExample::destructions) * (sizeof(LargeExample) + 4096),
+              manager.getReservedMemory());
+}
+
+TEST_F(MemoryManagerTest, PointerFreeObjectsShouldNotBeScanned)
+{
+    auto buffer = sd::make<std::array<uintptr_t, 16 * 1024>>();
+    for (int i = 0; i < 8; i++)
+    {
+        (*buffer)[i] = reinterpret_cast<uintptr_t>(make());
+    }
+    auto large = sd::make<LargeExample>();
+    large->ptr = make();
+
+    sd::MemoryManager::instance().garbageCollect();
+
+    EXPECT_LE(1, collectedCnt());
+    EXPECT_FALSE(wasCollected({large->ptr}));
+}
+
+TEST_F(MemoryManagerGenerationalTest, MinorCollectionShouldKeepObjectsReferencedFromLargeObject)
+{
+    auto old = sd::make<LargeExample>();
+    sd::MemoryManager::instance().minorGarbageCollect();
+
+    old->ptr = make();
+    auto young = old->ptr.get();
+    sd::MemoryManager::instance().minorGarbageCollect();
+
+    EXPECT_FALSE(wasCollected({young}));
+    EXPECT_EQ(young, old->ptr.get());
+}
+
+struct AtomicExample
+{
+    ExampleClass *ptrs[8] = {};
+};
+
+TEST_F(MemoryManagerTest, AtomicObjectsShouldNotBeScanned)
+{
+    auto atomic = sd::makeAtomic<AtomicExample>();
+    auto regular = sd::make<AtomicExample>();
+    for (int i = 0; i < 8; i++)
+    {
+        atomic->ptrs[i] = make();
+    }
+    regular->ptrs[0] = make();
+
+    sd::MemoryManager::instance().garbageCollect();
+
+    EXPECT_LE(1, collectedCnt());
+    EXPECT_FALSE(wasCollected({regular->ptrs[0]}));
+}
+
+TEST_F(MemoryManagerTest, ArrayShouldKeepReferencedObjects)
+{
+    auto array = sd::makeArray<ExampleClass *>(100);
+    for (int i = 0; i < 100; i++)
+    {
+        array[i] = make();
+    }
+
+    sd::MemoryManager::instance().garbageCollect();
+
+    EXPECT_EQ(100, sd::arrayLength(array));
+    EXPECT_FALSE(wasCollected(std::vector<ExampleClass *>(array, array + 100)));
+}
+
+struct ArrayElement
+{
+    static inline size_t destructions = 0;
+
+    int value = 7;
+
+    ~ArrayElement() { destructions++; }
+};
+
+TEST_F(MemoryManagerTest, ArraysShouldBeCollected)
+{
+    ArrayElement::destructions = 0;
+    for (int i = 0; i < 10; i++)
+    {
+        EXPECT_EQ(7, sd::makeArray<ArrayElement>(10)[9].value);
+    }
+
+    sd::MemoryManager::instance().garbageCollect();
+
+    EXPECT_LE(10, ArrayElement::destructions);
+}
+
+TEST_F(MemoryManagerTest, GrowArrayShouldMoveElements)
+{
+    auto array = sd::makeArray<ExampleClass *>(1);
+    array[0] = make();
+
+    auto grown = sd::growArray(array, 5);
+
+    EXPECT_LE(5, sd::arrayLength(grown));
+    EXPECT_EQ(array[0], grown[0]);
+    EXPECT_EQ(nullptr, grown[4]);
+    EXPECT_EQ(grown, sd::growArray(grown, 3));
+}
+
+TEST_F(MemoryManagerTest, ArrayShouldNotBeCreatedWhenSizeOverflows)
+{
+    auto tooLong = SIZE_MAX / sizeof(ExampleClass *) + 1;
+
+    EXPECT_THROW(sd::makeArray<ExampleClass *>(tooLong), std::bad_array_new_length);
+    EXPECT_THROW(sd::makeArray<ExampleClass *>(SIZE_MAX), std::bad_array_new_length);
+}
+
+TEST_F(MemoryManagerTest, RootsShouldKeepObjectsStoredOutsideOfStack)
+{
+    auto roots = std::make_unique<std::vector<sd::GcRoot<ExampleClass>>>();
+    for (int i = 0; i < 10; i++)
+    {
+        roots->emplace_back(make());
+    }
+
+    sd::MemoryManager::instance().garbageCollect();
+
+    for (auto &root : *roots)
+    {
+        EXPECT_FALSE(wasCollected({root.get()}));
+    }
+    roots->clear();
+    sd::MemoryManager::instance().garbageCollect();
+    EXPECT_LE(1, collectedCnt());
+}
+
+TEST_F(MemoryManagerTest, PreciseRootsModeShouldNotScanStack)
+{
+    auto &manager = sd::MemoryManager::instance();
+    manager.setPreciseRootsMode(true);
+    // objects left by previous tests are not rooted and go away here
+    manager.garbageCollect();
+    getCollectedObjects().clear();
+    sd::GcRoot<ExampleClass> root = make();
+    root->ptr = make();
+    auto local = make();
+
+    manager.garbageCollect();
+    manager.setPreciseRootsMode(false);
+
+    EXPECT_FALSE(wasCollected({root, root->ptr}));
+    EXPECT_TRUE(wasCollected({local}));
+    EXPECT_EQ(1, collectedCnt());
+}
+
+TEST_F(MemoryManagerTest, PreciseRootsModeShouldKeepObjectWhichAllocationTriggeredCollection)
+{
+    auto &manager = sd::MemoryManager::instance();
+    manager.setPreciseRootsMode(true);
+    auto collections = manager.stats().collections;
+    ExampleClass *last = nullptr;
+    while (manager.stats().collections == collections)
+    {
+        last = make();
+    }
+    sd::GcRoot<ExampleClass> root = last;
+    manager.garbageCollect();
+    manager.setPreciseRootsMode(false);
+
+    EXPECT_FALSE(wasCollected({root}));
+}
+
+TEST_F(MemoryManagerTest, ScanRangeShouldKeepObjectsReferencedFromIt)
+{
+    auto &manager = sd::MemoryManager::instance();
+    manager.setPreciseRootsMode(true);
+    manager.garbageCollect();
+    getCollectedObjects().clear();
+    // stands for stack of suspended fiber
+    auto stack = std::make_unique<ExampleClass *[]>(4);
+    stack[1] = make();
+    stack[3] = make();
+    sd::GcScanRange range{stack.get(), stack.get() + 4};
+
+    manager.garbageCollect();
+    EXPECT_EQ(0, collectedCnt());
+
+    range.set(stack.get(), stack.get() + 2);
+    manager.garbageCollect();
+    manager.setPreciseRootsMode(false);
+
+    EXPECT_FALSE(wasCollected({stack[1]}));
+    EXPECT_TRUE(wasCollected({stack[3]}));
+    EXPECT_EQ(1, collectedCnt());
+}
+
+#ifdef LINUX
+namespace
+{
+    ucontext_t threadContext;
+    std::function<void()> fiberBody;
+
+    void runFiberBody() { fiberBody(); }
+
+    void runOnFiber(uint8_t *stack, size_t size, std::function<void()> body)
+    {
+        fiberBody = std::move(body);
+        ucontext_t fiberContext;
+        getcontext(&fiberContext);
+        fiberContext.uc_stack.ss_sp = stack;
+        fiberContext.uc_stack.ss_size = size;
+        fiberContext.uc_link = &threadContext;
+        makecontext(&fiberContext, runFiberBody, 0);
+        swapcontext(&threadContext, &fiberContext);
+        fiberBody = nullptr;
+    }
+} // namespace
+
+TEST_F(MemoryManagerTest, CollectionOnRegisteredFiberStackShouldScanIt)
+{
+    auto &manager = sd::MemoryManager::instance();
+    constexpr size_t size = 256 * 1024;
+    auto stack = std::make_unique<uint8_t[]>(size);
+    sd::GcScanRange range{stack.get(), stack.get() + size};
+    auto collections = manager.stats().collections;
+    bool kept = false;
+
+    runOnFiber(stack.get(), size, [&] {
+        auto local = make();
+        manager.garbageCollect();
+        kept = !wasCollected({local});
+    });
+
+    EXPECT_EQ(collections + 1, manager.stats().collections);
+    EXPECT_TRUE(kept);
+}
+
+TEST_F(MemoryManagerTest, CollectionOnUnregisteredFiberStackShouldBePostponed)
+{
+    auto &manager = sd::MemoryManager::instance();
+    constexpr size_t size = 256 * 1024;
+    auto stack = std::make_unique<uint8_t[]>(size);
+    auto collections = manager.stats().collections;
+    ExampleClass *local = nullptr;
+
+    runOnFiber(stack.get(), size, [&] {
+        local = make();
+        // frames of this fiber can not be found, collecting now could free objects they refer
+        EXPECT_NO_THROW(manager.garbageCollect());
+    });
+
+    EXPECT_EQ(collections, manager.stats().collections);
+    EXPECT_FALSE(wasCollected({local}));
+    manager.garbageCollect();
+    EXPECT_EQ(collections + 1, manager.stats().collections);
+}
+
+TEST_F(MemoryManagerTest, PostponedCollectionShouldNotRaiseMemoryLimit)
+{
+    auto &manager = sd::MemoryManager::instance();
+    manager.garbageCollect();
+    constexpr size_t size = 256 * 1024;
+    auto stack = std::make_unique<uint8_t[]>(size);
+    auto collections = manager.stats().collections;
+    auto limit = manager.getMemoryLimit();
+
+    runOnFiber(stack.get(), size, [&] {
+        while (manager.getAllocatedMemory() < 4 * limit)
+        {
+            sd::makeArray<uint8_t>(64 * 1024);
+        }
+    });
+    EXPECT_EQ(collections, manager.stats().collections);
+    EXPECT_EQ(limit, manager.getMemoryLimit());
+
+    // first allocation on thread stack runs postponed collection
+    make();
+    EXPECT_EQ(collections + 1, manager.stats().collections);
+    EXPECT_EQ(limit, manager.getMemoryLimit());
+    EXPECT_GT(limit, manager.getAllocatedMemory());
+}
+#endif
+
+TEST_F(MemoryManagerTest, BlacklistedPagesShouldBeAvoidedByAllocator)
+{
+    auto &manager = sd::MemoryManager::instance();
+    manager.setPreciseRootsMode(true);
+    auto stack = std::make_unique<ExampleClass *[]>(2);
+    stack[1] = make();
+    sd::GcScanRange range{stack.get(), stack.get() + 2};
+    auto dead = make();
+    manager.garbageCollect();
+    EXPECT_TRUE(wasCollected({dead}));
+
+    // address of collected object left in scanned memory looks like pointer into heap
+    stack[0] = dead;
+    manager.setBlacklistingMode(true);
+    manager.garbageCollect();
+    auto lastCollection = manager.stats().lastCollection;
+    EXPECT_FALSE(wasCollected({stack[1]}));
+
+    auto page = [](void *ptr) { return reinterpret_cast<uintptr_t>(ptr) / 4096; };
+    for (int i = 0; i < 100; i++)
+    {
+        EXPECT_NE(page(dead), page(make()));
+    }
+    manager.setBlacklistingMode(false);
+    range.set(stack.get(), stack.get());
+    manager.garbageCollect();
+    manager.setPreciseRootsMode(false);
+
+    EXPECT_EQ(1, lastCollection.ambiguousRoots);
+    EXPECT_EQ(1, lastCollection.blacklistedPages);
+}
+
+TEST_F(MemoryManagerTest, WeakReferenceShouldBeClearedWhenTargetIsCollected)
+{
+    auto &manager = sd::MemoryManager::instance();
+    manager.setPreciseRootsMode(true);
+    manager.garbageCollect();
+    getCollectedObjects().clear();
+    sd::GcRoot<ExampleClass> root = make();
+    sd::GcWeak<ExampleClass> weakToLive = root.get();
+    sd::GcWeak<ExampleClass> weakToDead = make();
+
+    manager.garbageCollect();
+    manager.setPreciseRootsMode(false);
+
+    EXPECT_EQ(root.get(), weakToLive.get());
+    EXPECT_TRUE(weakToDead.expired());
+    EXPECT_EQ(1, collectedCnt());
+}
+
+struct WeakFieldExample
+{
+    sd::GcWeak<ExampleClass> weak;
+};
+
+TEST_F(MemoryManagerTest, WeakReferencesInObjectsShouldBeReleasedBySweeperThread)
+{
+    auto &manager = sd::MemoryManager::instance();
+    manager.setPreciseRootsMode(true);
+    manager.setBackgroundSweep(true);
+    sd::GcRoot<ExampleClass> root = make();
+    sd::GcWeak<ExampleClass> weak = root.get();
+    // sweeper destroys weak references of previous round while next collection walks the rest
+    for (int round = 0; round < 20; round++)
+    {
+        for (int i = 0; i < 1000; i++)
+        {
+            sd::make<WeakFieldExample>()->weak = root.get();
+        }
+        manager.garbageCollect();
+    }
+    manager.waitForSweeper();
+    manager.setBackgroundSweep(false);
+    manager.setPreciseRootsMode(false);
+
+    EXPECT_EQ(root.get(), weak.get());
+    EXPECT_FALSE(wasCollected({root.get()}));
+}
+
+TEST_F(MemoryManagerTest, WeakMapShouldDropEntriesOfCollectedKeys)
+{
+    auto &manager = sd::MemoryManager::instance();
+    manager.setPreciseRootsMode(true);
+    sd::GcWeakMap<ExampleClass, ExampleClass *> map;
+    sd::GcRoot<ExampleClass> liveKey = make();
+    map.insert(liveKey, make());
+    auto deadKey = make();
+    // value pointing to its own key must not keep entry alive
+    map.insert(deadKey, deadKey);
+
+    manager.garbageCollect();
+    manager.setPreciseRootsMode(false);
+
+    EXPECT_EQ(1, map.size());
+    EXPECT_FALSE(wasCollected({liveKey, *map.find(liveKey)}));
+    EXPECT_TRUE(wasCollected({deadKey}));
+    EXPECT_FALSE(map.contains(deadKey));
+}
+
+TEST_F(MemoryManagerTest, HeapSnapshotShouldGroupObjectsByType)
+{
+    auto &manager = sd::MemoryManager::instance();
+    auto object = make();
+    object->ptr = make();
+    sd::makeArray<int>(10);
+
+    auto snapshot = manager.takeHeapSnapshot();
+
+    auto findType = [&](const std::string &name) {
+        return std::find_if(snapshot.types.begin(), snapshot.types.end(),
+                            [&](auto &type) { return type.name == name; });
+    };
+    auto exampleType = findType("ExampleClass");
+    auto arrayType = findType("int []");
+    ASSERT_NE(snapshot.types.end(), exampleType);
+    ASSERT_NE(snapshot.types.end(), arrayType);
+    EXPECT_LE(2, exampleType->count);
+    EXPECT_EQ(exampleType->count * sizeof(ExampleClass), exampleType->bytes);
+    EXPECT_LE(1, exampleType->rootReferences);
+    EXPECT_EQ(1, arrayType->count);
+    EXPECT_EQ(10 * sizeof(int), arrayType->bytes);
+    EXPECT_EQ(manager.getObjectsCount(), snapshot.objects);
+
+    auto exampleIndex = static_cast<size_t>(exampleType - snapshot.types.begin());
+    EXPECT_TRUE(std::any_of(snapshot.references.begin(), snapshot.references.end(), [&](auto &reference) {
+        return reference.from == exampleIndex && reference.to == exampleIndex;
+    }));
+
+    std::ostringstream json;
+    snapshot.writeJson(json);
+    EXPECT_NE(std::string::npos, json.str().find("{\"name\":\"ExampleClass\""));
+    std::ostringstream binary;
+    snapshot.writeBinary(binary);
+    EXPECT_EQ(0, binary.str().find("SDHS"));
+}
+
+TEST_F(MemoryManagerTest, AllocationSitesShouldTrackSampledObjects)
+{
+    auto &manager = sd::MemoryManager::instance();
+    manager.setPreciseRootsMode(true);
+    manager.setAllocationSampleInterval(1);
+    sd::GcRoot<ExampleClass> root = make();
+    make();
+    make();
+
+    manager.garbageCollect();
+    manager.setAllocationSampleInterval(0);
+    manager.setPreciseRootsMode(false);
+
+    auto sites = manager.getAllocationSites();
+    manager.resetAllocationSites();
+    // each allocation is made from other line of test
+    EXPECT_EQ(3, sites.size());
+    size_t samples = 0, liveSamples = 0;
+    for (auto &site : sites)
+    {
+        ASSERT_EQ("ExampleClass", site.type);
+        EXPECT_FALSE(site.frames.empty());
+        EXPECT_EQ(site.samples * sizeof(ExampleClass), site.sampledBytes);
+        samples += site.samples;
+        liveSamples += site.liveSamples;
+    }
+    EXPECT_EQ(3, samples);
+    EXPECT_EQ(1, liveSamples);
+    EXPECT_TRUE(manager.getAllocationSites().empty());
+}
+
+struct CompactionExample
+{
+    size_t value = 0;
+};
+
+TEST_F(MemoryManagerTest, CompactionShouldMoveObjectsReferencedOnlyFromRoots)
+{
+    auto &manager = sd::MemoryManager::instance();
+    manager.setPreciseRootsMode(true);
+    manager.setCompactionMode(true);
+    std::vector<sd::GcRoot<CompactionExample>> roots;
+    std::vector<CompactionExample *> addresses;
+    roots.reserve(16);
+    for (size_t i = 0; i < 256; i++)
+    {
+        auto object = sd::make<CompactionExample>(i);
+        if (i % 16 == 0)
+        {
+            roots.emplace_back(object);
+            addresses.push_back(object);
+        }
+    }
+
+    manager.garbageCollect();
+    manager.setCompactionMode(false);
+    manager.setPreciseRootsMode(false);
+
+    EXPECT_EQ(16, manager.stats().lastCollection.movedObjects);
+    EXPECT_EQ(16 * sizeof(CompactionExample), manager.stats().lastCollection.movedBytes);
+    for (size_t i = 0; i < roots.size(); i++)
+    {
+        EXPECT_NE(addresses[i], roots[i].get());
+        EXPECT_EQ(i * 16, roots[i]->value);
+    }
+}
+
+TEST_F(MemoryManagerTest, CompactionShouldNotMoveObjectsReferencedFromScanRanges)
+{
+    auto &manager = sd::MemoryManager::instance();
+    manager.setPreciseRootsMode(true);
+    manager.setCompactionMode(true);
+    auto stack = std::make_unique<CompactionExample *[]>(1);
+    sd::GcScanRange range{stack.get(), stack.get() + 1};
+    std::vector<sd::GcRoot<CompactionExample>> roots;
+    roots.reserve(16);
+    for (size_t i = 0; i < 256; i++)
+    {
+        auto object = sd::make<CompactionExample>(i);
+        if (i % 16 == 0)
+        {
+            roots.emplace_back(object);
+        }
+    }
+    // range of suspended fiber refers object which is also reachable from root
+    stack[0] = roots[1];
+
+    manager.garbageCollect();
+    manager.setCompactionMode(false);
+    manager.setPreciseRootsMode(false);
+
+    EXPECT_EQ(0, manager.stats().lastCollection.movedObjects);
+    EXPECT_EQ(stack[0], roots[1].get());
+    EXPECT_EQ(16, stack[0]->value);
+}
+
+TEST_F(MemoryManagerTest, ScopeShouldCollectObjectsWhichDidNotEscape)
+{
+    auto &manager = sd::MemoryManager::instance();
+    auto old = sd::make<GenerationalExample>(getCollectedObjects());
+    auto minorCollections = manager.stats().minorCollections;
+    {
+        sd::GcScope scope;
+        old->ptr = make();
+        for (int i = 0; i < 100; i++)
+        {
+            make();
+        }
+        EXPECT_LT(0, manager.getYoungMemory());
+    }
+
+    EXPECT_EQ(minorCollections + 1, manager.stats().minorCollections);
+    EXPECT_EQ(0, manager.getYoungMemory());
+    EXPECT_FALSE(wasCollected({old->ptr.get()}));
+    EXPECT_LE(1, collectedCnt());
+}
+
+TEST_F(MemoryManagerTest, ScopeShouldKeepObjectsReferencedByPlainPointersOfOldObjects)
+{
+    auto &manager = sd::MemoryManager::instance();
+    manager.setPreciseRootsMode(true);
+    sd::GcRoot<ExampleClass> old = make();
+    ExampleClass *escaped = nullptr;
+    {
+        sd::GcScope scope;
+        // plain pointer bypasses write barrier
+        old->ptr = escaped = make();
+        make();
+    }
+    manager.setPreciseRootsMode(false);
+
+    EXPECT_EQ(1, collectedCnt());
+    EXPECT_FALSE(wasCollected({escaped}));
+    EXPECT_EQ(escaped, old->ptr);
+}
+
+TEST_F(MemoryManagerTest, MarkStackOverflowShouldNotLoseObjects)
+{
+    auto &manager = sd::MemoryManager::instance();
+    constexpr size_t length = 10000;
+    auto array = sd::makeArray<ExampleClass *>(length);
+    for (size_t i = 0; i < length; i++)
+    {
+        array[i] = make();
+    }
+    // capacity is kept after overflows of previous collections
+    manager.setMarkStackCapacity(1024);
+    auto overflows = manager.stats().markStackOverflows;
+
+    manager.garbageCollect();
+    auto capacity = manager.getMarkStackCapacity();
+    manager.setMarkStackCapacity(4096);
+
+    EXPECT_LT(overflows, manager.stats().markStackOverflows);
+    EXPECT_LE(2048, capacity);
+    auto &collected = getCollectedObjects();
+    std::sort(collected.begin(), collected.end());
+    EXPECT_TRUE(std::none_of(array, array + length, [&](ExampleClass *object) {
+        return std::binary_search(collected.begin(), collected.end(), object);
+    }));
+}
+
+struct ListElement
+{
+    static inline size_t destructions = 0;
+    int value;
+
+    ListElement(int value) : value(value) {}
+    ~ListElement() { destructions++; }
+};
+
+struct GcContainers
+{
+    sd::List<ListElement, sd::GcAllocator<ListElement>> list;
+    sd::Map<int, ExampleClass *, sd::GcAllocator<std::pair<const int, ExampleClass *>>> map;
+};
+
+TEST_F(MemoryManagerTest, GcAllocatorShouldLetContainerNodesBeCollected)
+{
+    auto &manager = sd::MemoryManager::instance();
+    manager.setPreciseRootsMode(true);
+    sd::GcRoot<GcContainers> root = sd::make<GcContainers>();
+    for (int i = 0; i < 10; i++)
+    {
+        root->list.emplaceBack(i);
+        root->map.insert({i, make()});
+    }
+    root->list.popFront();
+    ListElement::destructions = 0;
+
+    manager.garbageCollect();
+
+    EXPECT_EQ(0, ListElement::destructions);
+    EXPECT_EQ(9, root->list.size());
+    EXPECT_EQ(9, root->list.back().value);
+    for (auto &[key, object] : root->map)
+    {
+        EXPECT_FALSE(wasCollected({object}));
+    }
+
+    root = nullptr;
+    manager.garbageCollect();
+    manager.setPreciseRootsMode(false);
+
+    EXPECT_EQ(9, ListElement::destructions);
+    EXPECT_LE(10, collectedCnt());
+}
+
+TEST_F(MemoryManagerGenerationalTest, GcAllocatorNodesShouldSurviveMinorCollections)
+{
+    auto &manager = sd::MemoryManager::instance();
+    manager.setPreciseRootsMode(true);
+    sd::GcRoot<GcContainers> root = sd::make<GcContainers>();
+    manager.minorGarbageCollect();
+    ListElement::destructions = 0;
+
+    // old container links new nodes by raw pointers, write barrier does not see them
+    for (int i = 0; i < 10; i++)
+    {
+        root->list.emplaceBack(i);
+        manager.minorGarbageCollect();
+    }
+    manager.setPreciseRootsMode(false);
+
+    EXPECT_EQ(0, ListElement::destructions);
+    ASSERT_EQ(10, root->list.size());
+    EXPECT_EQ(0, root->list.front().value);
+    EXPECT_EQ(9, root->list.back().value);
+}
+
+struct FinalizableExample
+{
+    static inline size_t destructions = 0;
+    char buffer[64] = {};
+
+    ~FinalizableExample() { destructions++; }
+};
+
+template <> struct sd::IsFinalizable<FinalizableExample> : std::true_type
+{
+};
+
+TEST_F(MemoryManagerTest, FinalizableObjectsShouldBeDestroyedByFinalizers)
+{
+    auto &manager = sd::MemoryManager::instance();
+    manager.setPreciseRootsMode(true);
+    manager.garbageCollect();
+    auto allocated = manager.getAllocatedMemory();
+    for (int i = 0; i < 3; i++)
+    {
+        sd::make<FinalizableExample>();
+    }
+    FinalizableExample::destructions = 0;
+
+    manager.garbageCollect();
+    manager.setPreciseRootsMode(false);
+
+    EXPECT_EQ(0, FinalizableExample::destructions);
+    EXPECT_EQ(3, manager.getPendingFinalizers());
+    EXPECT_EQ(allocated, manager.getAllocatedMemory());
+
+    EXPECT_EQ(1, manager.runFinalizers(std::chrono::microseconds{0}));
+    EXPECT_EQ(2, manager.runFinalizers());
+    EXPECT_EQ(3, FinalizableExample::destructions);
+    EXPECT_EQ(0, manager.getPendingFinalizers());
+}